@@ -1,9 +1,70 @@
 #include "devices/block.h"
 #include <list.h>
+#include <round.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Number of buckets in a request size histogram.  Bucket 0
+   counts requests for 1 sector, bucket 1 for 2 sectors, bucket 2
+   for 3 or 4 sectors, and so on, with the last bucket counting
+   every request larger than that. */
+#define SIZE_BUCKETS 9
+
+/* Number of buckets in a request latency histogram.  Bucket 0
+   counts requests that took less than 2 time-stamp counter
+   cycles, and bucket I > 0 those that took 2**I cycles or more,
+   but less than 2**(I + 1), with the last bucket counting every
+   request slower than that. */
+#define LATENCY_BUCKETS 48
+
+/* Most requests, and most sectors, that a queue combines into a
+   single transfer. */
+#define MERGE_CNT 16
+#define MERGE_SECTORS 32
+
+/* Timer ticks that a queued read or write may wait before the
+   deadline scheduler dispatches it ahead of everything else. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (TIMER_FREQ * 5)
+
+/* Most sectors of a transfer to or from user memory to copy
+   through a kernel buffer at once.  See submit_and_wait(). */
+#define USER_BOUNCE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A device's queue of requests, from which a worker thread
+   dispatches one transfer at a time, in the order chosen by the
+   queue's scheduler.  Requests that several threads submit to
+   one device wait here in order, but devices with their own
+   queues, such as disks on different IDE channels, transfer at
+   the same time. */
+struct io_queue
+  {
+    struct lock lock;                   /* Protects the members below. */
+    struct condition not_empty;         /* Signaled when a request arrives. */
+    struct list requests;               /* Requests, in arrival order. */
+    const struct io_scheduler *scheduler; /* Dispatch policy. */
+    block_sector_t head;                /* Sector after the last dispatched. */
+    uint8_t *bounce;                    /* Buffer for merged transfers,
+                                           or null if merging is off. */
+  };
+
+/* An I/O scheduling policy. */
+struct io_scheduler
+  {
+    const char *name;                   /* Name, e.g. "noop". */
+
+    /* Returns the request in the nonempty queue Q that should be
+       dispatched next, without removing it. */
+    struct block_request *(*pick) (struct io_queue *q);
+  };
 
 /* A block device. */
 struct block
@@ -19,11 +80,43 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long seek_dist;       /* Total seek distance in sectors. */
+    block_sector_t next_sector;         /* Sector after the last accessed. */
+
+    /* Number of read and write requests, by size. */
+    unsigned long long read_sizes[SIZE_BUCKETS];
+    unsigned long long write_sizes[SIZE_BUCKETS];
+
+    /* Number of read and write requests, by latency from
+       submission to completion. */
+    unsigned long long read_latency[LATENCY_BUCKETS];
+    unsigned long long write_latency[LATENCY_BUCKETS];
+
+    unsigned in_flight;                 /* Requests not yet complete. */
+    unsigned max_in_flight;             /* Most IN_FLIGHT ever. */
+    unsigned long long submit_cnt;      /* Requests submitted. */
+    unsigned long long depth_sum;       /* Sum of IN_FLIGHT after each
+                                           request was submitted. */
+
+    struct io_queue *queue;             /* Request queue, or null to
+                                           call the driver directly. */
   };
 
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
+/* Block I/O by threads that have exited, totaled by name. */
+struct thread_io
+  {
+    struct list_elem elem;              /* Element in exited_io. */
+    char name[16];                      /* Name of the threads. */
+    unsigned thread_cnt;                /* Number of threads. */
+    unsigned long long read_cnt;        /* Sectors read. */
+    unsigned long long write_cnt;       /* Sectors written. */
+    unsigned long long request_cnt;     /* Requests submitted. */
+  };
+static struct list exited_io = LIST_INITIALIZER (exited_io);
+
 /* The block block assigned to each Pintos role. */
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
@@ -99,20 +192,49 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/* Verifies that SECTOR is a valid offset within BLOCK.
-   Panics if not. */
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
 static void
-check_sector (struct block *block, block_sector_t sector)
+check_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
 {
-  if (sector >= block->size)
+  if (sector >= block->size || cnt > block->size - sector)
     {
       /* We do not use ASSERT because we want to panic here
          regardless of whether NDEBUG is defined. */
       PANIC ("Access past end of device %s (sector=%"PRDSNu", "
-             "size=%"PRDSNu")\n", block_name (block), sector, block->size);
+             "count=%"PRDSNu", size=%"PRDSNu")\n",
+             block_name (block), sector, cnt, block->size);
     }
 }
 
+/* Returns the request size histogram bucket for a request of CNT
+   sectors. */
+static int
+size_bucket (block_sector_t cnt)
+{
+  int bucket = 0;
+
+  while (bucket < SIZE_BUCKETS - 1 && (1u << bucket) < cnt)
+    bucket++;
+  return bucket;
+}
+
+/* Adds the distance from the end of the previous access to BLOCK
+   to SECTOR to BLOCK's total seek distance, and notes that the
+   access covered CNT sectors.  For a disk, this approximates how
+   far its head moves: an access that just continues from the
+   previous one adds nothing. */
+static void
+account_seek (struct block *block, block_sector_t sector,
+              block_sector_t cnt)
+{
+  block->seek_dist += (sector > block->next_sector
+                       ? sector - block->next_sector
+                       : block->next_sector - sector);
+  block->next_sector = sector + cnt;
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +242,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +253,368 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Records a transfer of CNT sectors starting at SECTOR in
+   BLOCK's statistics, as a read or, if WRITE, a write. */
+static void
+account (struct block *block, bool write, block_sector_t sector,
+         block_sector_t cnt)
+{
+  if (write)
+    {
+      block->write_cnt += cnt;
+      block->write_sizes[size_bucket (cnt)]++;
+    }
+  else
+    {
+      block->read_cnt += cnt;
+      block->read_sizes[size_bucket (cnt)]++;
+    }
+  account_seek (block, sector, cnt);
+}
+
+/* Transfers the CNT consecutive sectors starting at SECTOR
+   between BLOCK and BUFFER, as a single driver request if BLOCK's
+   driver supports it, writing to BLOCK if WRITE is true and
+   reading from it otherwise.  Updates BLOCK's statistics. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          block_sector_t cnt, void *buffer_)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *buffer = buffer_;
+
+  if (cnt > 1 && write && ops->write_multiple != NULL)
+    ops->write_multiple (block->aux, sector, cnt, buffer);
+  else if (cnt > 1 && !write && ops->read_multiple != NULL)
+    ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    {
+      block_sector_t i;
+
+      for (i = 0; i < cnt; i++)
+        if (write)
+          ops->write (block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+        else
+          ops->read (block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  account (block, write, sector, cnt);
+}
+
+/* Returns true if BLOCK has been assigned a Pintos role. */
+static bool
+has_role (struct block *block)
+{
+  int i;
+
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (block_by_role[i] == block)
+      return true;
+  return false;
+}
+
+/* Returns the latency histogram bucket for a request that took
+   CYCLES time-stamp counter cycles. */
+static int
+latency_bucket (uint64_t cycles)
+{
+  int bucket = 0;
+
+  while (bucket < LATENCY_BUCKETS - 1 && cycles >= 2)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
+
+/* Notes that R has been passed to BLOCK, for BLOCK's queue depth
+   and latency statistics.  If BLOCK plays a Pintos role, also
+   charges R to the running thread, so that a request passed down
+   from a partition or striped device to the disks below it is
+   only charged once. */
+static void
+note_submit (struct block *block, struct block_request *r)
+{
+  enum intr_level old_level;
+
+  if (has_role (block))
+    {
+      struct thread *t = thread_current ();
+      if (r->write)
+        t->io_write_cnt += r->cnt;
+      else
+        t->io_read_cnt += r->cnt;
+      t->io_request_cnt++;
+    }
+
+  if (r->level_cnt >= BLOCK_LEVELS)
+    return;
+  r->levels[r->level_cnt].block = block;
+  r->levels[r->level_cnt].cycles = timer_cycles ();
+  r->level_cnt++;
+
+  /* Requests to a device stacked on others may complete in any of
+     their worker threads. */
+  old_level = intr_disable ();
+  block->in_flight++;
+  if (block->in_flight > block->max_in_flight)
+    block->max_in_flight = block->in_flight;
+  block->depth_sum += block->in_flight;
+  block->submit_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Records R's latency at each device it was passed to. */
+static void
+note_complete (struct block_request *r)
+{
+  uint64_t now = timer_cycles ();
+  enum intr_level old_level;
+  int i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < r->level_cnt; i++)
+    {
+      struct block *block = r->levels[i].block;
+      int bucket = latency_bucket (now - r->levels[i].cycles);
+
+      if (r->write)
+        block->write_latency[bucket]++;
+      else
+        block->read_latency[bucket]++;
+      block->in_flight--;
+    }
+  intr_set_level (old_level);
+}
+
+/* Marks R complete, by calling its callback or waking up the
+   thread waiting for it.  For use by drivers that implement the
+   SUBMIT operation and do not pass R on to another device. */
+void
+block_complete (struct block_request *r)
+{
+  note_complete (r);
+  if (r->complete != NULL)
+    r->complete (r);
+  else
+    sema_up (&r->done);
+}
+
+/* Passes request R to BLOCK's queue or driver. */
+static void
+start_request (struct block *block, struct block_request *r)
+{
+  ASSERT (r->cnt > 0);
+  check_sectors (block, r->sector, r->cnt);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+  note_submit (block, r);
+
+  if (block->queue != NULL)
+    {
+      struct io_queue *q = block->queue;
+
+      r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+      lock_acquire (&q->lock);
+      list_push_back (&q->requests, &r->elem);
+      cond_signal (&q->not_empty, &q->lock);
+      lock_release (&q->lock);
+    }
+  else if (block->ops->submit != NULL)
+    {
+      account (block, r->write, r->sector, r->cnt);
+      block->ops->submit (block->aux, r);
+    }
+  else
+    {
+      transfer (block, r->write, r->sector, r->cnt, r->buffer);
+      block_complete (r);
+    }
+}
+
+/* Starts request R to BLOCK, whose submitter must have set R's
+   WRITE, SECTOR, CNT, BUFFER, COMPLETE, and AUX members, and
+   returns without waiting for it, if BLOCK's driver allows.
+   BUFFER must be in kernel memory, because R may be carried out
+   in another thread, which cannot see the submitter's user
+   memory.
+   Completion is signaled as described for struct block_request.
+   BLOCK's driver may complete R before this function returns,
+   even from the calling thread. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  ASSERT (is_kernel_vaddr (r->buffer));
+
+  sema_init (&r->done, 0);
+  r->level_cnt = 0;
+  start_request (block, r);
+}
+
+/* Passes request R, which was submitted to a device stacked on
+   BLOCK, on to BLOCK, so that it completes once BLOCK has carried
+   it out.  For use by the SUBMIT operation of the device above,
+   which may have changed R's SECTOR. */
+void
+block_forward (struct block *block, struct block_request *r)
+{
+  start_request (block, r);
+}
+
+/* Waits for request R, which must have been submitted with a null
+   COMPLETE, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+}
+
+/* Submits a request to transfer CNT sectors starting at SECTOR
+   between BLOCK and BUFFER, which must be in kernel memory, and
+   waits for it to complete. */
+static void
+submit_and_wait_kernel (struct block *block, bool write,
+                        block_sector_t sector, block_sector_t cnt,
+                        void *buffer)
+{
+  struct block_request r;
+
+  r.write = write;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.complete = NULL;
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Submits a request to transfer CNT sectors starting at SECTOR
+   between BLOCK and BUFFER, and waits for it to complete.
+
+   BUFFER may be in user memory, which is only mapped in the
+   running thread's page directory, but a request may be carried
+   out in a device's worker thread.  So the data in a user buffer
+   is copied through a kernel buffer here, USER_BOUNCE_SECTORS at
+   a time. */
+static void
+submit_and_wait (struct block *block, bool write, block_sector_t sector,
+                 block_sector_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  uint8_t *bounce;
+
+  if (is_kernel_vaddr (buffer))
+    {
+      submit_and_wait_kernel (block, write, sector, cnt, buffer);
+      return;
+    }
+
+  bounce = malloc ((cnt < USER_BOUNCE_SECTORS ? cnt : USER_BOUNCE_SECTORS)
+                   * BLOCK_SECTOR_SIZE);
+  if (bounce == NULL)
+    PANIC ("Failed to allocate memory for user block transfer.");
+  while (cnt > 0)
+    {
+      block_sector_t n = (cnt < USER_BOUNCE_SECTORS
+                          ? cnt : USER_BOUNCE_SECTORS);
+      size_t size = n * BLOCK_SECTOR_SIZE;
+
+      if (write)
+        memcpy (bounce, buffer, size);
+      submit_and_wait_kernel (block, write, sector, n, bounce);
+      if (!write)
+        memcpy (buffer, bounce, size);
+
+      sector += n;
+      cnt -= n;
+      buffer += size;
+    }
+  free (bounce);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes, as a single request if BLOCK's driver supports it.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     block_sector_t cnt, void *buffer)
+{
+  if (cnt > 0)
+    submit_and_wait (block, false, sector, cnt, buffer);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes,
+   as a single request if BLOCK's driver supports it.  Returns
+   after the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      block_sector_t cnt, const void *buffer)
+{
+  /* Writes only read from BUFFER, despite the cast. */
+  if (cnt > 0)
+    submit_and_wait (block, true, sector, cnt, (void *) buffer);
+}
+
+/* Returns the number of entries at the start of the CNT in IOV
+   that describe consecutive sectors in consecutive memory, so
+   that they can be transferred as a single request. */
+static size_t
+run_length (const struct block_iovec *iov, size_t cnt)
+{
+  size_t n = 1;
+
+  while (n < cnt
+         && iov[n].sector == iov[0].sector + n
+         && ((uint8_t *) iov[n].buffer
+             == (uint8_t *) iov[0].buffer + n * BLOCK_SECTOR_SIZE))
+    n++;
+  return n;
+}
+
+/* Reads the CNT sectors described by IOV from BLOCK, each into
+   its own buffer, which need not be adjacent in memory, and the
+   sectors need not be adjacent on BLOCK either.  Runs of
+   consecutive sectors going to consecutive memory are read with
+   a single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_readv (struct block *block, const struct block_iovec *iov,
+             size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t n = run_length (iov, cnt);
+      block_read_multiple (block, iov->sector, n, iov->buffer);
+      iov += n;
+      cnt -= n;
+    }
+}
+
+/* Writes the CNT sectors described by IOV to BLOCK, each from its
+   own buffer, like block_readv().  Returns after the block
+   device has acknowledged receiving all of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_writev (struct block *block, const struct block_iovec *iov,
+              size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t n = run_length (iov, cnt);
+      block_write_multiple (block, iov->sector, n, iov->buffer);
+      iov += n;
+      cnt -= n;
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,22 +638,480 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Request scheduling. */
+
+/* Dispatches requests in arrival order. */
+static struct block_request *
+noop_pick (struct io_queue *q)
+{
+  return list_entry (list_front (&q->requests), struct block_request, elem);
+}
+
+/* Dispatches the request with the lowest sector at or after the
+   head, or if there is none the lowest sector overall, so that
+   the head sweeps across the device in one direction and then
+   jumps back to the start (C-LOOK). */
+static struct block_request *
+clook_pick (struct io_queue *q)
+{
+  struct block_request *ahead = NULL;
+  struct block_request *lowest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+      if (r->sector >= q->head && (ahead == NULL || r->sector < ahead->sector))
+        ahead = r;
+    }
+  return ahead != NULL ? ahead : lowest;
+}
+
+/* Dispatches the oldest read that has passed its deadline, or
+   failing that the oldest such write, and otherwise does the same
+   as C-LOOK.  Reads expire sooner than writes because a thread is
+   usually waiting for each one. */
+static struct block_request *
+deadline_pick (struct io_queue *q)
+{
+  int64_t now = timer_ticks ();
+  struct block_request *write = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->deadline <= now)
+        {
+          if (!r->write)
+            return r;
+          if (write == NULL)
+            write = r;
+        }
+    }
+  return write != NULL ? write : clook_pick (q);
+}
+
+/* Available I/O schedulers. */
+static const struct io_scheduler schedulers[] =
+  {
+    {"noop", noop_pick},
+    {"clook", clook_pick},
+    {"deadline", deadline_pick},
+  };
+#define SCHEDULER_CNT (sizeof schedulers / sizeof *schedulers)
+
+/* Scheduler for queues enabled from now on. */
+static const struct io_scheduler *default_scheduler = &schedulers[2];
+
+/* Returns the scheduler with the given NAME, or a null pointer if
+   there is none. */
+static const struct io_scheduler *
+find_scheduler (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < SCHEDULER_CNT; i++)
+    if (!strcmp (name, schedulers[i].name))
+      return &schedulers[i];
+  return NULL;
+}
+
+/* Removes from BLOCK's queue the requests that can be combined
+   with R, which has already been removed, into a single transfer:
+   those in the same direction that extend R's run of sectors at
+   either end, up to MERGE_CNT requests and MERGE_SECTORS sectors
+   in all.  Stores R and them into BATCH in sector order and
+   returns how many there are.  The queue must be locked. */
+static size_t
+merge_requests (struct block *block, struct block_request *r,
+                struct block_request *batch[MERGE_CNT])
+{
+  struct io_queue *q = block->queue;
+  block_sector_t first = r->sector;
+  block_sector_t cnt = r->cnt;
+  size_t n = 1;
+  bool merged;
+
+  batch[0] = r;
+  if (q->bounce == NULL
+      || (r->write
+          ? block->ops->write_multiple == NULL
+          : block->ops->read_multiple == NULL))
+    return n;
+
+  do
+    {
+      struct list_elem *e, *next;
+
+      merged = false;
+      for (e = list_begin (&q->requests);
+           e != list_end (&q->requests) && n < MERGE_CNT; e = next)
+        {
+          struct block_request *m = list_entry (e, struct block_request, elem);
+
+          next = list_next (e);
+          if (m->write != r->write || cnt + m->cnt > MERGE_SECTORS)
+            continue;
+          if (m->sector == first + cnt)
+            batch[n++] = m;
+          else if (m->sector + m->cnt == first)
+            {
+              memmove (batch + 1, batch, n * sizeof *batch);
+              batch[0] = m;
+              n++;
+              first = m->sector;
+            }
+          else
+            continue;
+          cnt += m->cnt;
+          list_remove (&m->elem);
+          merged = true;
+        }
+    }
+  while (merged && n < MERGE_CNT);
+
+  return n;
+}
+
+/* Carries out the N requests in BATCH, which go in the same
+   direction and cover a run of sectors on BLOCK in order, as a
+   single transfer, and completes them. */
+static void
+dispatch (struct block *block, struct block_request *batch[], size_t n)
+{
+  struct block_request *first = batch[0];
+  struct block_request *last = batch[n - 1];
+  block_sector_t cnt = last->sector + last->cnt - first->sector;
+  uint8_t *bounce = block->queue->bounce;
+  size_t i;
+
+  if (n == 1)
+    transfer (block, first->write, first->sector, first->cnt,
+              first->buffer);
+  else if (first->write)
+    {
+      for (i = 0; i < n; i++)
+        memcpy (bounce + (batch[i]->sector - first->sector)
+                * BLOCK_SECTOR_SIZE,
+                batch[i]->buffer, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+      transfer (block, true, first->sector, cnt, bounce);
+    }
+  else
+    {
+      transfer (block, false, first->sector, cnt, bounce);
+      for (i = 0; i < n; i++)
+        memcpy (batch[i]->buffer,
+                bounce + (batch[i]->sector - first->sector)
+                * BLOCK_SECTOR_SIZE,
+                batch[i]->cnt * BLOCK_SECTOR_SIZE);
+    }
+
+  for (i = 0; i < n; i++)
+    block_complete (batch[i]);
+}
+
+/* Worker thread that dispatches the requests in the queue of
+   BLOCK_, a struct block. */
+static void
+queue_worker (void *block_)
+{
+  struct block *block = block_;
+  struct io_queue *q = block->queue;
+
+  for (;;)
+    {
+      struct block_request *batch[MERGE_CNT];
+      struct block_request *r;
+      size_t n;
+
+      lock_acquire (&q->lock);
+      while (list_empty (&q->requests))
+        cond_wait (&q->not_empty, &q->lock);
+      r = q->scheduler->pick (q);
+      list_remove (&r->elem);
+      n = merge_requests (block, r, batch);
+      q->head = batch[n - 1]->sector + batch[n - 1]->cnt;
+      lock_release (&q->lock);
+
+      dispatch (block, batch, n);
+    }
+}
+
+/* Sends future requests to BLOCK through a queue, served by a
+   worker thread in the order chosen by the default scheduler.
+   This is worthwhile for devices, such as disks, where the order
+   of requests affects how fast they complete.  Call it at most
+   once per device. */
+void
+block_enable_queue (struct block *block)
+{
+  struct io_queue *q;
+  char name[16];
+
+  ASSERT (block->queue == NULL);
+
+  q = malloc (sizeof *q);
+  if (q == NULL)
+    PANIC ("Failed to allocate memory for block device queue");
+  lock_init (&q->lock);
+  cond_init (&q->not_empty);
+  list_init (&q->requests);
+  q->scheduler = default_scheduler;
+  q->head = 0;
+  q->bounce = palloc_get_multiple (0, DIV_ROUND_UP (MERGE_SECTORS
+                                                    * BLOCK_SECTOR_SIZE,
+                                                    PGSIZE));
+  block->queue = q;
+
+  snprintf (name, sizeof name, "%.*s-io", (int) sizeof name - 4,
+            block->name);
+  if (thread_create (name, PRI_DEFAULT, queue_worker, block) == TID_ERROR)
+    PANIC ("Failed to start worker thread for %s", block->name);
+}
+
+/* Makes BLOCK's queue dispatch requests with the scheduler named
+   NAME, one of "noop", "clook", or "deadline".  Returns true if
+   successful, false if BLOCK has no queue or there is no such
+   scheduler. */
+bool
+block_set_scheduler (struct block *block, const char *name)
+{
+  const struct io_scheduler *scheduler = find_scheduler (name);
+  struct io_queue *q = block->queue;
+
+  if (q == NULL || scheduler == NULL)
+    return false;
+  lock_acquire (&q->lock);
+  q->scheduler = scheduler;
+  lock_release (&q->lock);
+  return true;
+}
+
+/* Makes queues enabled from now on use the scheduler named NAME.
+   Returns true if successful, false if there is no such
+   scheduler. */
+bool
+block_set_default_scheduler (const char *name)
+{
+  const struct io_scheduler *scheduler = find_scheduler (name);
+
+  if (scheduler == NULL)
+    return false;
+  default_scheduler = scheduler;
+  return true;
+}
+
+/* Returns the name of the scheduler for BLOCK's queue, or "none"
+   if BLOCK does not have a queue. */
+const char *
+block_scheduler_name (struct block *block)
+{
+  return block->queue != NULL ? block->queue->scheduler->name : "none";
+}
+
+/* Prints histogram SIZES of requests of type WHAT, if it has
+   any requests at all. */
+static void
+print_sizes (const char *what, const unsigned long long sizes[])
+{
+  int i;
+
+  for (i = 0; i < SIZE_BUCKETS; i++)
+    if (sizes[i] != 0)
+      break;
+  if (i >= SIZE_BUCKETS)
+    return;
+
+  printf ("  %s requests by size:", what);
+  for (i = 0; i < SIZE_BUCKETS; i++)
+    if (sizes[i] != 0)
+      {
+        unsigned hi = 1u << i;
+        unsigned lo = i > 0 ? hi / 2 + 1 : 1;
+        if (i == SIZE_BUCKETS - 1)
+          printf (" %u+: %llu", lo, sizes[i]);
+        else if (lo == hi)
+          printf (" %u: %llu", lo, sizes[i]);
+        else
+          printf (" %u-%u: %llu", lo, hi, sizes[i]);
+      }
+  printf ("\n");
+}
+
+/* Returns an upper bound on the latency, in microseconds, of the
+   requests in latency histogram BUCKET. */
+static uint64_t
+bucket_us (int bucket)
+{
+  return timer_cycles_to_us ((uint64_t) 2 << bucket);
+}
+
+/* Prints the median, 99th percentile, and worst latencies in
+   histogram LATENCY of requests of type WHAT, if it has any
+   requests at all.  Each is rounded up to the top of its bucket,
+   so it may be up to twice the true latency. */
+static void
+print_latency (const char *what, const unsigned long long latency[])
+{
+  unsigned long long total = 0;
+  unsigned long long sum;
+  int p50 = -1, p99 = -1, max = 0;
+  int i;
+
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    total += latency[i];
+  if (total == 0)
+    return;
+
+  sum = 0;
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    if (latency[i] != 0)
+      {
+        sum += latency[i];
+        if (p50 < 0 && sum * 2 >= total)
+          p50 = i;
+        if (p99 < 0 && sum * 100 >= total * 99)
+          p99 = i;
+        max = i;
+      }
+
+  printf ("  %s latency: p50 <%"PRIu64" us, p99 <%"PRIu64" us, "
+          "max <%"PRIu64" us (%llu requests)\n",
+          what, bucket_us (p50), bucket_us (p99), bucket_us (max), total);
+}
+
+/* Prints the sectors that thread NAME, or THREAD_CNT threads of
+   that name, read and wrote with REQUEST_CNT requests. */
+static void
+print_thread_io (const char *name, unsigned thread_cnt,
+                 unsigned long long read_cnt, unsigned long long write_cnt,
+                 unsigned long long request_cnt)
+{
+  printf ("  %s", name);
+  if (thread_cnt > 1)
+    printf (" (%u threads)", thread_cnt);
+  printf (": %llu sectors read, %llu sectors written, %llu requests\n",
+          read_cnt, write_cnt, request_cnt);
+}
+
+/* Returns the totals for exited threads named NAME, or a null
+   pointer if there are none yet.  Interrupts must be off. */
+static struct thread_io *
+find_thread_io (const char *name)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&exited_io); e != list_end (&exited_io);
+       e = list_next (e))
+    {
+      struct thread_io *io = list_entry (e, struct thread_io, elem);
+      if (!strcmp (io->name, name))
+        return io;
+    }
+  return NULL;
+}
+
+/* Adds T's block I/O to IO.  Interrupts must be off. */
+static void
+add_thread_io (struct thread_io *io, const struct thread *t)
+{
+  io->thread_cnt++;
+  io->read_cnt += t->io_read_cnt;
+  io->write_cnt += t->io_write_cnt;
+  io->request_cnt += t->io_request_cnt;
+}
+
+/* Adds the block I/O that T, which is exiting, has done to the
+   totals for threads of its name, which block_print_stats()
+   prints. */
+void
+block_account_thread (struct thread *t)
+{
+  struct thread_io *io, *new_io;
+  enum intr_level old_level;
+
+  if (t->io_request_cnt == 0)
+    return;
+
+  old_level = intr_disable ();
+  io = find_thread_io (t->name);
+  if (io != NULL)
+    add_thread_io (io, t);
+  intr_set_level (old_level);
+  if (io != NULL)
+    return;
+
+  /* Allocate with interrupts on, then check again, in case
+     another thread of the same name got there first. */
+  new_io = calloc (1, sizeof *new_io);
+  if (new_io == NULL)
+    return;
+  strlcpy (new_io->name, t->name, sizeof new_io->name);
+
+  old_level = intr_disable ();
+  io = find_thread_io (t->name);
+  if (io == NULL)
+    {
+      list_push_back (&exited_io, &new_io->elem);
+      io = new_io;
+      new_io = NULL;
+    }
+  add_thread_io (io, t);
+  intr_set_level (old_level);
+  free (new_io);
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role, and for the block I/O done by each thread. */
 void
 block_print_stats (void)
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
   int i;
 
-  for (i = 0; i < BLOCK_CNT; i++)
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes, "
+                  "%llu sectors seek distance\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt, block->seek_dist);
+          print_sizes ("read", block->read_sizes);
+          print_sizes ("write", block->write_sizes);
+          print_latency ("read", block->read_latency);
+          print_latency ("write", block->write_latency);
+          if (block->submit_cnt != 0)
+            {
+              unsigned long long depth = (block->depth_sum * 100
+                                          / block->submit_cnt);
+              printf ("  %llu kB read, %llu kB written, queue depth "
+                      "max %u, average %llu.%02llu\n",
+                      block->read_cnt * BLOCK_SECTOR_SIZE / 1024,
+                      block->write_cnt * BLOCK_SECTOR_SIZE / 1024,
+                      block->max_in_flight, depth / 100, depth % 100);
+            }
         }
     }
+
+  printf ("Block I/O by thread:\n");
+  for (e = list_begin (&exited_io); e != list_end (&exited_io);
+       e = list_next (e))
+    {
+      struct thread_io *io = list_entry (e, struct thread_io, elem);
+      print_thread_io (io->name, io->thread_cnt, io->read_cnt,
+                       io->write_cnt, io->request_cnt);
+    }
+  if (cur->io_request_cnt != 0)
+    print_thread_io (cur->name, 1, cur->io_read_cnt, cur->io_write_cnt,
+                     cur->io_request_cnt);
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +1136,17 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->seek_dist = 0;
+  block->next_sector = 0;
+  memset (block->read_sizes, 0, sizeof block->read_sizes);
+  memset (block->write_sizes, 0, sizeof block->write_sizes);
+  memset (block->read_latency, 0, sizeof block->read_latency);
+  memset (block->write_latency, 0, sizeof block->write_latency);
+  block->in_flight = 0;
+  block->max_in_flight = 0;
+  block->submit_cnt = 0;
+  block->depth_sum = 0;
+  block->queue = NULL;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -49,22 +52,102 @@ struct block *block_get_by_name (const char *name);
 struct block *block_first (void);
 struct block *block_next (struct block *);
 
+/* One sector of a scatter/gather transfer. */
+struct block_iovec
+  {
+    block_sector_t sector;      /* Sector on the device. */
+    void *buffer;               /* BLOCK_SECTOR_SIZE bytes in memory. */
+  };
+
+/* Most devices whose latency a single request is timed at, as it
+   is passed from one device down to another. */
+#define BLOCK_LEVELS 4
+
+/* An asynchronous request to a block device.  The submitter sets
+   the members in the first group and passes the request to
+   block_submit(), after which the block layer owns the request
+   until it completes.  Then, if COMPLETE is non-null, the block
+   layer calls it, from a thread that must not be kept waiting
+   for long; otherwise, the submitter must call block_wait().
+
+   A request passed through to another device, as by a partition,
+   may have a different SECTOR by the time it completes. */
+struct block_request
+  {
+    bool write;                 /* Write rather than read? */
+    block_sector_t sector;      /* First sector. */
+    block_sector_t cnt;         /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes, in
+                                   kernel memory. */
+    void (*complete) (struct block_request *);  /* Callback, or null. */
+    void *aux;                  /* For the submitter's use. */
+
+    /* Owned by the block layer. */
+    struct list_elem elem;      /* Element in a device's queue. */
+    int64_t deadline;           /* Timer tick to dispatch it by. */
+    struct semaphore done;      /* Up'd on completion if no callback. */
+
+    /* Each device the request has been passed to, outermost
+       first, with the time-stamp counter when it got there. */
+    struct
+      {
+        struct block *block;
+        uint64_t cycles;
+      }
+    levels[BLOCK_LEVELS];
+    int level_cnt;              /* Number of LEVELS in use. */
+  };
+
 /* Block device operations. */
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t,
+                          block_sector_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t,
+                           block_sector_t cnt, const void *);
+void block_readv (struct block *, const struct block_iovec *, size_t cnt);
+void block_writev (struct block *, const struct block_iovec *, size_t cnt);
+void block_submit (struct block *, struct block_request *);
+void block_forward (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+void block_complete (struct block_request *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Request scheduling. */
+void block_enable_queue (struct block *);
+bool block_set_scheduler (struct block *, const char *name);
+bool block_set_default_scheduler (const char *name);
+const char *block_scheduler_name (struct block *);
+
 /* Statistics. */
+struct thread;
+void block_account_thread (struct thread *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTIPLE and WRITE_MULTIPLE transfer CNT consecutive
+   sectors in a single request.  They are optional: a driver that
+   leaves them null has its multi-sector requests carried out one
+   sector at a time by READ and WRITE.
+
+   SUBMIT is optional too.  A driver for a device stacked on
+   others, such as a partition, can use it to hand a request that
+   has been checked against the device's bounds to a device below
+   with block_forward(), without waiting for it, or to split it
+   into requests of its own, submitted with block_submit(), and
+   call block_complete() once they are all done. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                            const void *buffer);
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -0,0 +1,485 @@
+#include "devices/compress.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <lz4.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A block device that compresses its contents onto another, its
+   backing device.
+
+   The device is divided into chunks of CHUNK_SECTORS sectors,
+   each compressed as a unit.  The backing device holds one more
+   slot of CHUNK_SECTORS sectors than there are chunks, and each
+   stored chunk occupies as many sectors at the start of some
+   slot as its compressed form needs, so compression saves
+   transfers rather than space.  A chunk that does not compress
+   well is stored as is, and a chunk of zeros is not stored at
+   all.
+
+   The map, which records where and how each chunk is stored,
+   follows a header sector at the start of the backing device.
+   It is kept in memory and each map sector is written through
+   as it changes.  A chunk is never overwritten in place: a
+   changed chunk goes to a free slot, and only once it is there
+   does the map sector switch to it and its old slot become free.
+   A crash at any point thus leaves every chunk readable, in its
+   old form or its new one.
+
+   Transfers are serialized, because they share the buffers in
+   struct compress, so there is at most one request at a time in
+   flight to the backing device. */
+struct compress
+  {
+    struct list_elem elem;              /* Element in all_compress. */
+    struct block *block;                /* The compressed device. */
+    struct block *backing;              /* Device the chunks go to. */
+    block_sector_t chunk_cnt;           /* Number of chunks. */
+    block_sector_t slot_cnt;            /* Number of slots. */
+    block_sector_t data_start;          /* First sector of slot 0. */
+    uint32_t *map;                      /* Map entry for each chunk. */
+    struct bitmap *used_slots;          /* Slots that hold a chunk. */
+    block_sector_t next_slot;           /* Where to look for a slot. */
+
+    struct lock lock;                   /* Serializes transfers. */
+    uint8_t *chunk;                     /* A chunk, uncompressed. */
+    uint8_t *packed;                    /* A chunk, compressed. */
+    uint16_t *table;                    /* Compressor hash table. */
+
+    /* Statistics. */
+    unsigned long long read_bytes;      /* Bytes read from device. */
+    unsigned long long write_bytes;     /* Bytes written to device. */
+    unsigned long long stored_bytes;    /* Chunk bytes written below. */
+    unsigned long long zero_cnt;        /* Chunks written as zeros. */
+    unsigned long long packed_cnt;      /* Chunks written compressed. */
+    unsigned long long raw_cnt;         /* Chunks written as is. */
+    unsigned long long error_cnt;       /* Corrupt chunks read. */
+    uint64_t cycles;                    /* Time spent in transfers. */
+  };
+
+/* Sectors per chunk, and bytes. */
+#define CHUNK_SECTORS 8
+#define CHUNK_SIZE (CHUNK_SECTORS * BLOCK_SECTOR_SIZE)
+
+/* Map entries.  The low 4 bits of an entry are the number of
+   sectors that the chunk occupies, between these two values if
+   it is compressed, and the rest are its slot.  A chunk of zeros
+   has entry ZERO_CHUNK. */
+#define ZERO_CHUNK 0                    /* All zeros, not stored. */
+#define RAW_CHUNK CHUNK_SECTORS         /* Stored uncompressed. */
+#define MAKE_ENTRY(SLOT, SECTORS) ((uint32_t) (SLOT) << 4 | (SECTORS))
+#define ENTRY_SLOT(ENTRY) ((ENTRY) >> 4)
+#define ENTRY_SECTORS(ENTRY) ((ENTRY) & 0xf)
+
+/* Map entries per map sector. */
+#define MAP_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (uint32_t))
+
+/* A compressed chunk starts with a 2-byte little-endian count of
+   the bytes of LZ4 data that follow it. */
+#define PACKED_HEADER 2
+
+/* Sector 0 of the backing device, the header.  The map starts in
+   sector 1. */
+#define COMPRESS_MAGIC 0x325a4c43       /* "CLZ2". */
+struct compress_header
+  {
+    uint32_t magic;                     /* COMPRESS_MAGIC. */
+    uint32_t chunk_cnt;                 /* Number of chunks. */
+    uint32_t unused[126];               /* Not used. */
+  };
+
+/* All compressed devices. */
+static struct list all_compress = LIST_INITIALIZER (all_compress);
+
+static struct block_operations compress_operations;
+
+/* Returns true if the CHUNK_SIZE bytes at DATA are all zero. */
+static bool
+is_zero (const uint8_t *data)
+{
+  const uint32_t *p = (const uint32_t *) data;
+  size_t i;
+
+  for (i = 0; i < CHUNK_SIZE / sizeof *p; i++)
+    if (p[i] != 0)
+      return false;
+  return true;
+}
+
+/* Returns the first sector of slot SLOT of Z. */
+static block_sector_t
+slot_sector (const struct compress *z, block_sector_t slot)
+{
+  return z->data_start + slot * CHUNK_SECTORS;
+}
+
+/* Reads chunk CHUNK_NO of Z into BUFFER, which must have room for
+   CHUNK_SIZE bytes.  Block devices cannot return an error to
+   their callers, so if the chunk is corrupt, reports an I/O
+   error on the console and fills BUFFER with zeros instead. */
+static void
+load_chunk (struct compress *z, block_sector_t chunk_no, uint8_t *buffer)
+{
+  uint32_t entry = z->map[chunk_no];
+  size_t sectors = ENTRY_SECTORS (entry);
+  size_t len;
+
+  if (entry == ZERO_CHUNK)
+    memset (buffer, 0, CHUNK_SIZE);
+  else if (sectors == RAW_CHUNK)
+    block_read_multiple (z->backing, slot_sector (z, ENTRY_SLOT (entry)),
+                         CHUNK_SECTORS, buffer);
+  else
+    {
+      block_read_multiple (z->backing, slot_sector (z, ENTRY_SLOT (entry)),
+                           sectors, z->packed);
+      len = z->packed[0] | (z->packed[1] << 8);
+      if (len > sectors * BLOCK_SECTOR_SIZE - PACKED_HEADER
+          || lz4_decompress (z->packed + PACKED_HEADER, len,
+                             buffer, CHUNK_SIZE) != CHUNK_SIZE)
+        {
+          printf ("%s: I/O error: chunk %"PRDSNu" is corrupt\n",
+                  block_name (z->block), chunk_no);
+          z->error_cnt++;
+          memset (buffer, 0, CHUNK_SIZE);
+        }
+    }
+}
+
+/* Sets the map entry for chunk CHUNK_NO of Z to ENTRY, writing
+   the map sector that holds it, and frees the slot that the
+   chunk occupied before, if any. */
+static void
+set_entry (struct compress *z, block_sector_t chunk_no, uint32_t entry)
+{
+  block_sector_t map_sector = chunk_no / MAP_ENTRIES;
+  uint32_t old_entry = z->map[chunk_no];
+
+  if (old_entry == entry)
+    return;
+  z->map[chunk_no] = entry;
+  block_write (z->backing, 1 + map_sector,
+               z->map + map_sector * MAP_ENTRIES);
+  if (old_entry != ZERO_CHUNK)
+    bitmap_reset (z->used_slots, ENTRY_SLOT (old_entry));
+}
+
+/* Allocates a free slot in Z and returns it.  There is always
+   one, because Z has one more slot than chunks. */
+static block_sector_t
+allocate_slot (struct compress *z)
+{
+  size_t slot;
+
+  slot = bitmap_scan_and_flip (z->used_slots, z->next_slot, 1, false);
+  if (slot == BITMAP_ERROR)
+    slot = bitmap_scan_and_flip (z->used_slots, 0, 1, false);
+  ASSERT (slot != BITMAP_ERROR);
+  z->next_slot = (slot + 1) % z->slot_cnt;
+  return slot;
+}
+
+/* Writes the CHUNK_SIZE bytes at DATA to Z as chunk CHUNK_NO,
+   compressed if that saves at least one sector.  The chunk goes
+   to a fresh slot, so that until the map entry switches to it,
+   the chunk's old form stays intact. */
+static void
+store_chunk (struct compress *z, block_sector_t chunk_no,
+             const uint8_t *data)
+{
+  block_sector_t slot;
+  size_t sectors;
+  size_t len;
+
+  if (is_zero (data))
+    {
+      set_entry (z, chunk_no, ZERO_CHUNK);
+      z->zero_cnt++;
+      return;
+    }
+
+  slot = allocate_slot (z);
+  len = lz4_compress (data, CHUNK_SIZE, z->packed + PACKED_HEADER,
+                      (RAW_CHUNK - 1) * BLOCK_SECTOR_SIZE - PACKED_HEADER,
+                      z->table);
+  if (len > 0)
+    {
+      sectors = DIV_ROUND_UP (PACKED_HEADER + len, BLOCK_SECTOR_SIZE);
+      z->packed[0] = len & 0xff;
+      z->packed[1] = len >> 8;
+      memset (z->packed + PACKED_HEADER + len, 0,
+              sectors * BLOCK_SECTOR_SIZE - PACKED_HEADER - len);
+      block_write_multiple (z->backing, slot_sector (z, slot), sectors,
+                            z->packed);
+      z->packed_cnt++;
+    }
+  else
+    {
+      sectors = RAW_CHUNK;
+      block_write_multiple (z->backing, slot_sector (z, slot),
+                            CHUNK_SECTORS, data);
+      z->raw_cnt++;
+    }
+  z->stored_bytes += sectors * BLOCK_SECTOR_SIZE;
+  set_entry (z, chunk_no, MAKE_ENTRY (slot, sectors));
+}
+
+/* Reads the CNT sectors starting at SECTOR from compressed
+   device Z_ into BUFFER. */
+static void
+compress_read_multiple (void *z_, block_sector_t sector, block_sector_t cnt,
+                        void *buffer_)
+{
+  struct compress *z = z_;
+  uint8_t *buffer = buffer_;
+  uint64_t start;
+
+  lock_acquire (&z->lock);
+  start = timer_cycles ();
+  z->read_bytes += cnt * BLOCK_SECTOR_SIZE;
+  while (cnt > 0)
+    {
+      block_sector_t chunk_no = sector / CHUNK_SECTORS;
+      block_sector_t ofs = sector % CHUNK_SECTORS;
+      block_sector_t n = CHUNK_SECTORS - ofs;
+
+      if (n > cnt)
+        n = cnt;
+      if (ENTRY_SECTORS (z->map[chunk_no]) == RAW_CHUNK)
+        {
+          /* Read a run of chunks stored as is in adjacent slots
+             straight into BUFFER all at once. */
+          block_sector_t slot = ENTRY_SLOT (z->map[chunk_no]);
+
+          while (n < cnt
+                 && (z->map[(sector + n) / CHUNK_SECTORS]
+                     == MAKE_ENTRY (slot + (sector + n) / CHUNK_SECTORS
+                                    - chunk_no, RAW_CHUNK)))
+            n += cnt - n < CHUNK_SECTORS ? cnt - n : CHUNK_SECTORS;
+          block_read_multiple (z->backing, slot_sector (z, slot) + ofs, n,
+                               buffer);
+        }
+      else if (n == CHUNK_SECTORS)
+        load_chunk (z, chunk_no, buffer);
+      else
+        {
+          load_chunk (z, chunk_no, z->chunk);
+          memcpy (buffer, z->chunk + ofs * BLOCK_SECTOR_SIZE,
+                  n * BLOCK_SECTOR_SIZE);
+        }
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+  z->cycles += timer_cycles () - start;
+  lock_release (&z->lock);
+}
+
+/* Writes the CNT sectors starting at SECTOR to compressed device
+   Z_ from BUFFER.  A write that covers only part of a chunk has
+   to read the rest of the chunk first. */
+static void
+compress_write_multiple (void *z_, block_sector_t sector,
+                         block_sector_t cnt, const void *buffer_)
+{
+  struct compress *z = z_;
+  const uint8_t *buffer = buffer_;
+  uint64_t start;
+
+  lock_acquire (&z->lock);
+  start = timer_cycles ();
+  z->write_bytes += cnt * BLOCK_SECTOR_SIZE;
+  while (cnt > 0)
+    {
+      block_sector_t chunk_no = sector / CHUNK_SECTORS;
+      block_sector_t ofs = sector % CHUNK_SECTORS;
+      block_sector_t n = CHUNK_SECTORS - ofs;
+
+      if (n > cnt)
+        n = cnt;
+      if (n == CHUNK_SECTORS)
+        store_chunk (z, chunk_no, buffer);
+      else
+        {
+          load_chunk (z, chunk_no, z->chunk);
+          memcpy (z->chunk + ofs * BLOCK_SECTOR_SIZE, buffer,
+                  n * BLOCK_SECTOR_SIZE);
+          store_chunk (z, chunk_no, z->chunk);
+        }
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+  z->cycles += timer_cycles () - start;
+  lock_release (&z->lock);
+}
+
+/* Reads sector SECTOR from compressed device Z into BUFFER. */
+static void
+compress_read (void *z, block_sector_t sector, void *buffer)
+{
+  compress_read_multiple (z, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to compressed device Z from BUFFER. */
+static void
+compress_write (void *z, block_sector_t sector, const void *buffer)
+{
+  compress_write_multiple (z, sector, 1, buffer);
+}
+
+static struct block_operations compress_operations =
+  {
+    compress_read,
+    compress_write,
+    compress_read_multiple,
+    compress_write_multiple,
+    NULL
+  };
+
+/* Reads Z's header and map from its backing device, or if the
+   backing device does not hold a compressed device of the same
+   size, starts over with every chunk zero.  Marks the slots that
+   the map uses, reading any chunk whose map entry is invalid or
+   shares a slot with another chunk as zeros. */
+static void
+load_map (struct compress *z, block_sector_t map_sectors)
+{
+  struct compress_header *h = (struct compress_header *) z->chunk;
+  block_sector_t chunk_no;
+
+  block_read (z->backing, 0, h);
+  if (h->magic == COMPRESS_MAGIC && h->chunk_cnt == z->chunk_cnt)
+    {
+      block_read_multiple (z->backing, 1, map_sectors, z->map);
+      for (chunk_no = 0; chunk_no < z->chunk_cnt; chunk_no++)
+        {
+          uint32_t entry = z->map[chunk_no];
+          block_sector_t slot = ENTRY_SLOT (entry);
+
+          if (entry == ZERO_CHUNK)
+            continue;
+          if (ENTRY_SECTORS (entry) == ZERO_CHUNK
+              || ENTRY_SECTORS (entry) > RAW_CHUNK
+              || slot >= z->slot_cnt
+              || bitmap_test (z->used_slots, slot))
+            {
+              printf ("%s: I/O error: chunk %"PRDSNu" has a bad map "
+                      "entry\n", block_name (z->block), chunk_no);
+              z->error_cnt++;
+              z->map[chunk_no] = ZERO_CHUNK;
+            }
+          else
+            bitmap_mark (z->used_slots, slot);
+        }
+      return;
+    }
+
+  printf ("%s: initializing compressed device on %s\n",
+          block_name (z->block), block_name (z->backing));
+  memset (h, 0, sizeof *h);
+  h->magic = COMPRESS_MAGIC;
+  h->chunk_cnt = z->chunk_cnt;
+  block_write (z->backing, 0, h);
+  block_write_multiple (z->backing, 1, map_sectors, z->map);
+}
+
+/* Creates and registers a compressed block device on BACKING,
+   named "z" followed by BACKING's name, of the same type.  Panics
+   if BACKING is too small or there is not enough memory.  Returns
+   the new device. */
+struct block *
+compress_create (struct block *backing)
+{
+  block_sector_t size = block_size (backing);
+  block_sector_t map_sectors;
+  struct compress *z;
+  char name[16];
+  char extra_info[32];
+
+  ASSERT (block_type (backing) != BLOCK_FOREIGN);
+  snprintf (name, sizeof name, "z%s", block_name (backing));
+  if (size < 1 + 1 + 2 * CHUNK_SECTORS)
+    PANIC ("%s: %s is too small", name, block_name (backing));
+
+  z = calloc (1, sizeof *z);
+  if (z == NULL)
+    PANIC ("%s: out of memory", name);
+  z->backing = backing;
+
+  /* One map sector for up to MAP_ENTRIES chunks, and a slot for
+     each chunk plus one to write a changed chunk to. */
+  z->chunk_cnt = (size - 1) / CHUNK_SECTORS - 1;
+  map_sectors = DIV_ROUND_UP (z->chunk_cnt, MAP_ENTRIES);
+  while (1 + map_sectors + (z->chunk_cnt + 1) * CHUNK_SECTORS > size)
+    {
+      z->chunk_cnt--;
+      map_sectors = DIV_ROUND_UP (z->chunk_cnt, MAP_ENTRIES);
+    }
+  z->slot_cnt = z->chunk_cnt + 1;
+  z->data_start = 1 + map_sectors;
+
+  z->map = calloc (map_sectors, BLOCK_SECTOR_SIZE);
+  z->used_slots = bitmap_create (z->slot_cnt);
+  z->chunk = palloc_get_multiple (0, DIV_ROUND_UP (CHUNK_SIZE, PGSIZE));
+  z->packed = palloc_get_multiple (0, DIV_ROUND_UP (CHUNK_SIZE, PGSIZE));
+  z->table = malloc (LZ4_TABLE_SIZE * sizeof *z->table);
+  if (z->map == NULL || z->used_slots == NULL || z->chunk == NULL
+      || z->packed == NULL || z->table == NULL)
+    PANIC ("%s: out of memory", name);
+  lock_init (&z->lock);
+
+  snprintf (extra_info, sizeof extra_info, "compressed on %s",
+            block_name (backing));
+  z->block = block_register (name, block_type (backing), extra_info,
+                             z->chunk_cnt * CHUNK_SECTORS,
+                             &compress_operations, z);
+  load_map (z, map_sectors);
+  list_push_back (&all_compress, &z->elem);
+  return z->block;
+}
+
+/* Prints the compression ratio and throughput of each compressed
+   device. */
+void
+compress_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_compress); e != list_end (&all_compress);
+       e = list_next (e))
+    {
+      struct compress *z = list_entry (e, struct compress, elem);
+      unsigned long long bytes = z->read_bytes + z->write_bytes;
+      uint64_t us = timer_cycles_to_us (z->cycles);
+
+      printf ("%s: %llu kB written as %llu kB", block_name (z->block),
+              z->write_bytes / 1024, z->stored_bytes / 1024);
+      if (z->stored_bytes > 0)
+        {
+          unsigned long long ratio = z->write_bytes * 100 / z->stored_bytes;
+          printf (" (%llu.%02llu:1)", ratio / 100, ratio % 100);
+        }
+      printf (", %llu zero, %llu compressed, %llu stored chunks\n",
+              z->zero_cnt, z->packed_cnt, z->raw_cnt);
+      if (z->error_cnt > 0)
+        printf ("%s: %llu corrupt chunks\n", block_name (z->block),
+                z->error_cnt);
+      if (us > 0)
+        {
+          /* Hundredths of a MB/s. */
+          unsigned long long rate = bytes * 100 * 1000000 / us
+                                    / (1024 * 1024);
+          printf ("%s: %llu kB read and written in %"PRIu64" ms, "
+                  "%llu.%02llu MB/s\n", block_name (z->block),
+                  bytes / 1024, us / 1000, rate / 100, rate % 100);
+        }
+    }
+}
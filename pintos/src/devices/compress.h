@@ -0,0 +1,9 @@
+#ifndef DEVICES_COMPRESS_H
+#define DEVICES_COMPRESS_H
+
+#include "devices/block.h"
+
+struct block *compress_create (struct block *backing);
+void compress_print_stats (void);
+
+#endif /* devices/compress.h */
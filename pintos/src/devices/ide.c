@@ -5,13 +5,19 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  Where the
+   controller is a PCI bus-master IDE controller, such as the
+   PIIX that QEMU emulates, transfers use DMA as described in
+   [SFF-8038i]; otherwise they use PIO. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +40,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +56,42 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master register port addresses, relative to the channel's
+   bus master base. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.  Writing 1 to ERR or INT
+   clears it. */
+#define BM_ST_ACTIVE 0x01       /* Transfer in progress. */
+#define BM_ST_ERR 0x02          /* Transfer failed. */
+#define BM_ST_INT 0x04          /* Disk raised its interrupt. */
+
+/* A Physical Region Descriptor, which describes one physically
+   contiguous piece of a DMA transfer.  A piece may not cross a
+   64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Bytes, with 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the table's last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Most sectors transferred by a single command.  A sector count
+   of 0 in the Sector Count register means this many. */
+#define MAX_COMMAND_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +100,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int block_sectors;          /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 1 if not supported. */
+    bool dma;                   /* Does the disk support DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +118,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base port, or 0 if none. */
+    struct prd *prdt;           /* PRD table for DMA transfers. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -84,11 +133,23 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
-
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int max_sectors);
+static uint16_t find_bus_master (void);
+
+static void pio_read (struct ata_disk *, block_sector_t, block_sector_t cnt,
+                      void *);
+static void pio_write (struct ata_disk *, block_sector_t, block_sector_t cnt,
+                       const void *);
+static bool use_dma (const struct ata_disk *, const void *);
+static bool dma_transfer (struct ata_disk *, block_sector_t,
+                          block_sector_t cnt, const void *, bool write);
+
+static void select_sectors (struct ata_disk *, block_sector_t,
+                            block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, block_sector_t cnt);
+static void output_sectors (struct channel *, const void *,
+                            block_sector_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +162,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +188,18 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Each channel has 8 bytes of bus master registers.  The
+         PRD table must be 4-byte aligned and may not cross a
+         64 kB boundary, which a page satisfies. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +210,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->block_sectors = 1;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -279,7 +355,7 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,12 +379,74 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Word 47 gives the most sectors the disk can transfer per
+     interrupt with READ/WRITE MULTIPLE. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+
+  /* Word 49 bit 8 says whether the disk supports DMA. */
+  d->dma = (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_enable_queue (block);
   partition_scan (block);
 }
 
+/* Enables READ/WRITE MULTIPLE on disk D with the largest power
+   of 2 sectors per interrupt that is no more than MAX_SECTORS,
+   and records it in D.  If MAX_SECTORS is 0, or the disk rejects
+   the setting, leaves D transferring 1 sector per interrupt. */
+static void
+set_multiple_mode (struct ata_disk *d, int max_sectors)
+{
+  struct channel *c = d->channel;
+  int sectors = 1;
+
+  while (sectors * 2 <= max_sectors)
+    sectors *= 2;
+  if (sectors == 1)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), sectors);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_status (c)) & STA_ERR))
+    d->block_sectors = sectors;
+}
+
+/* Looks for a PCI bus-master IDE controller that decodes the
+   legacy channel ports, and enables it as a bus master.  Returns
+   its bus master base port, or 0 if there is none. */
+static uint16_t
+find_bus_master (void) 
+{
+  struct pci_address a;
+  uint32_t prog_if, bar;
+
+  if (!pci_find_class (0x01, 0x01, &a))
+    return 0;
+
+  /* Programming interface bits 0 and 2 select native rather than
+     legacy ports for each channel, and bit 7 means the controller
+     can be a bus master. */
+  prog_if = (pci_read_config (&a, PCI_REG_CLASS) >> 8) & 0xff;
+  if ((prog_if & 0x05) != 0 || (prog_if & 0x80) == 0)
+    return 0;
+
+  /* BAR 4 holds the bus master registers, in I/O space. */
+  bar = pci_read_config (&a, PCI_REG_BAR (4));
+  if ((bar & 1) == 0 || (bar & 0xfffc) == 0)
+    return 0;
+
+  pci_write_config (&a, PCI_REG_COMMAND,
+                    (pci_read_config (&a, PCI_REG_COMMAND)
+                     | PCI_CMD_IO | PCI_CMD_MASTER));
+  return bar & 0xfffc;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +475,246 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Each command moves up to MAX_COMMAND_SECTORS sectors, by DMA
+   if possible, otherwise by PIO.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      block_sector_t n = (cnt < MAX_COMMAND_SECTORS
+                          ? cnt : MAX_COMMAND_SECTORS);
+
+      if (!use_dma (d, buffer) || !dma_transfer (d, sec_no, n, buffer, false))
+        pio_read (d, sec_no, n, buffer);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Each command moves up to MAX_COMMAND_SECTORS sectors, by DMA
+   if possible, otherwise by PIO.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                    const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      block_sector_t n = (cnt < MAX_COMMAND_SECTORS
+                          ? cnt : MAX_COMMAND_SECTORS);
+
+      if (!use_dma (d, buffer) || !dma_transfer (d, sec_no, n, buffer, true))
+        pio_write (d, sec_no, n, buffer);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
 
+/* PIO and DMA transfers. */
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER with a single PIO command, taking one interrupt per
+   D->block_sectors sectors.  CNT must be between 1 and
+   MAX_COMMAND_SECTORS.  D's channel must be locked. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt,
+          void *buffer_)
+{
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, (cnt > 1 && d->block_sectors > 1
+                         ? CMD_READ_MULTIPLE
+                         : CMD_READ_SECTOR_RETRY));
+  while (cnt > 0)
+    {
+      block_sector_t n = (cnt < (block_sector_t) d->block_sectors
+                          ? cnt : (block_sector_t) d->block_sectors);
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
+      input_sectors (c, buffer, n);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER with a single PIO command, taking one interrupt per
+   D->block_sectors sectors.  CNT must be between 1 and
+   MAX_COMMAND_SECTORS.  D's channel must be locked. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt,
+           const void *buffer_)
+{
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, (cnt > 1 && d->block_sectors > 1
+                         ? CMD_WRITE_MULTIPLE
+                         : CMD_WRITE_SECTOR_RETRY));
+  while (cnt > 0)
+    {
+      block_sector_t n = (cnt < (block_sector_t) d->block_sectors
+                          ? cnt : (block_sector_t) d->block_sectors);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+      output_sectors (c, buffer, n);
+      sema_down (&c->completion_wait);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
+}
+
+/* Returns true if a transfer between disk D and BUFFER can use
+   DMA.  The controller can only reach BUFFER if it is in kernel
+   memory, which maps physical memory directly, and 2-byte
+   aligned. */
+static bool
+use_dma (const struct ata_disk *d, const void *buffer)
+{
+  return (d->dma && d->channel->bm_base != 0
+          && is_kernel_vaddr (buffer) && ((uintptr_t) buffer & 1) == 0);
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D
+   and BUFFER with a single DMA command, writing to the disk if
+   WRITE is true and reading from it otherwise.  The calling
+   thread sleeps until the disk interrupts at the end of the
+   transfer.  CNT must be between 1 and MAX_COMMAND_SECTORS, and
+   use_dma() must be true for D and BUFFER.  D's channel must be
+   locked.
+
+   Returns true if successful.  On failure, turns DMA off for the
+   channel and returns false, so that the caller can retry with
+   PIO. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt,
+              const void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uintptr_t addr = vtop (buffer);
+  size_t size = cnt * BLOCK_SECTOR_SIZE;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  struct prd *prd;
+  uint8_t bm_status;
+
+  ASSERT (use_dma (d, buffer));
+
+  /* Describe the buffer, split at 64 kB boundaries. */
+  for (prd = c->prdt; ; prd++)
+    {
+      size_t n = 0x10000 - (addr & 0xffff);
+      if (n > size)
+        n = size;
+      prd->addr = addr;
+      prd->size = n & 0xffff;
+      prd->flags = 0;
+      addr += n;
+      size -= n;
+      if (size == 0)
+        break;
+    }
+  prd->flags = PRD_EOT;
+
+  /* Program the bus master, clearing any old error or interrupt,
+     then issue the command and start the transfer. */
+  outb (reg_bm_command (c), direction);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_ST_ERR | BM_ST_INT);
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check for errors. */
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_ST_ERR | BM_ST_INT);
+  if ((bm_status & BM_ST_ERR) != 0
+      || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      c->bm_base = 0;
+      return false;
+    }
+  return true;
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection registers,
+   to access the CNT sectors starting at SEC_NO.  (We use LBA
+   mode.)  CNT must be between 1 and MAX_COMMAND_SECTORS. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no,
+                block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_COMMAND_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_COMMAND_SECTORS);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -414,20 +735,22 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, block_sector_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, block_sector_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
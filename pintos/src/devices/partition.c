@@ -1,5 +1,7 @@
 #include "devices/partition.h"
 #include <packed.h>
+#include <round.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -13,43 +15,119 @@ struct partition
     block_sector_t start;               /* First sector within device. */
   };
 
+/* Sectors that partition_scan() reads from the start of a device
+   in a single request: the master boot record, the GPT header,
+   and a GPT partition entry array of the usual 128 entries of 128
+   bytes each, which together hold the whole partition table of
+   most devices. */
+#define SCAN_SECTORS 34
+
+/* Most extended partition tables to read from one device, which
+   keeps a table that links back to itself from looping forever. */
+#define MAX_EXTENDED 128
+
+/* Largest GPT partition entry array to read, in sectors. */
+#define GPT_MAX_SECTORS 128
+
+/* An extended partition table to read. */
+struct extended_table
+  {
+    block_sector_t sector;              /* Sector of the table. */
+    block_sector_t primary;             /* Sector of the top-level
+                                           extended partition table. */
+  };
+
+/* A scan of a device for partitions. */
+struct scan
+  {
+    struct block *block;                /* Device being scanned. */
+    uint8_t *head;                      /* First HEAD_CNT sectors. */
+    block_sector_t head_cnt;            /* Number of sectors in HEAD. */
+    int part_nr;                        /* Partitions found so far. */
+    struct extended_table *extended;    /* Extended tables found. */
+    int extended_cnt;                   /* Number of EXTENDED in use. */
+  };
+
 static struct block_operations partition_operations;
 
-static void read_partition_table (struct block *, block_sector_t sector,
-                                  block_sector_t primary_extended_sector,
-                                  int *part_nr);
-static void found_partition (struct block *, uint8_t type,
+static void read_partition_table (struct scan *, block_sector_t sector,
+                                  block_sector_t primary_extended_sector);
+static void read_gpt (struct scan *);
+static void found_partition (struct block *, enum block_type,
                              block_sector_t start, block_sector_t size,
-                             int part_nr);
+                             int part_nr, const char *extra_info);
 static const char *partition_type_name (uint8_t);
 
 /* Scans BLOCK for partitions of interest to Pintos. */
 void
 partition_scan (struct block *block)
 {
-  int part_nr = 0;
-  read_partition_table (block, 0, 0, &part_nr);
-  if (part_nr == 0)
+  struct scan s;
+  int i;
+
+  s.block = block;
+  s.head_cnt = (block_size (block) < SCAN_SECTORS
+                ? block_size (block) : SCAN_SECTORS);
+  s.head = malloc (s.head_cnt * BLOCK_SECTOR_SIZE);
+  if (s.head == NULL)
+    PANIC ("Failed to allocate memory for partition table.");
+  s.part_nr = 0;
+  s.extended = malloc (MAX_EXTENDED * sizeof *s.extended);
+  if (s.extended == NULL)
+    PANIC ("Failed to allocate memory for partition table.");
+  s.extended_cnt = 0;
+
+  /* Read the top-level partition table, then each extended
+     partition table in the order they are found.  Following the
+     chain of extended tables in a loop, instead of recursing
+     from each table into the next, keeps a long chain from
+     overflowing the kernel stack. */
+  block_read_multiple (block, 0, s.head_cnt, s.head);
+  read_partition_table (&s, 0, 0);
+  for (i = 0; i < s.extended_cnt; i++)
+    read_partition_table (&s, s.extended[i].sector, s.extended[i].primary);
+
+  if (s.part_nr == 0)
     printf ("%s: Device contains no partitions\n", block_name (block));
+  free (s.extended);
+  free (s.head);
+}
+
+/* Reads the CNT sectors starting at SECTOR of the device that S
+   is scanning into BUFFER, from the sectors read at the start of
+   the scan if they are among them. */
+static void
+read_sectors (struct scan *s, block_sector_t sector, block_sector_t cnt,
+              void *buffer)
+{
+  if (sector < s->head_cnt && cnt <= s->head_cnt - sector)
+    memcpy (buffer, s->head + sector * BLOCK_SECTOR_SIZE,
+            cnt * BLOCK_SECTOR_SIZE);
+  else
+    block_read_multiple (s->block, sector, cnt, buffer);
 }
 
-/* Reads the partition table in the given SECTOR of BLOCK and
-   scans it for partitions of interest to Pintos.
+/* Reads the partition table in the given SECTOR of the device
+   that S is scanning and scans it for partitions of interest to
+   Pintos.  If the table is a protective MBR, which marks the
+   device as partitioned with a GUID partition table, scans the
+   GPT instead.
 
    If SECTOR is 0, so that this is the top-level partition table
-   on BLOCK, then PRIMARY_EXTENDED_SECTOR is not meaningful;
+   on the device, then PRIMARY_EXTENDED_SECTOR is not meaningful;
    otherwise, it should designate the sector of the top-level
    extended partition table that was traversed to arrive at
    SECTOR, for use in finding logical partitions (see the large
    comment below).
 
-   PART_NR points to the number of non-empty primary or logical
-   partitions already encountered on BLOCK.  It is incremented as
-   partitions are found. */
+   S's PART_NR is the number of non-empty primary or logical
+   partitions already encountered on the device.  It is
+   incremented as partitions are found.  Extended partition
+   tables that this one links to are added to S's EXTENDED, for
+   the caller to read in turn. */
 static void
-read_partition_table (struct block *block, block_sector_t sector,
-                      block_sector_t primary_extended_sector,
-                      int *part_nr)
+read_partition_table (struct scan *s, block_sector_t sector,
+                      block_sector_t primary_extended_sector)
 {
   /* Format of a partition table entry.  See [Partitions]. */
   struct partition_table_entry
@@ -72,6 +150,7 @@ read_partition_table (struct block *block, block_sector_t sector,
     }
   PACKED;
 
+  struct block *block = s->block;
   struct partition_table *pt;
   size_t i;
 
@@ -88,7 +167,7 @@ read_partition_table (struct block *block, block_sector_t sector,
   pt = malloc (sizeof *pt);
   if (pt == NULL)
     PANIC ("Failed to allocate memory for partition table.");
-  block_read (block, 0, pt);
+  read_sectors (s, sector, 1, pt);
 
   /* Check signature. */
   if (pt->signature != 0xaa55)
@@ -102,6 +181,18 @@ read_partition_table (struct block *block, block_sector_t sector,
       return;
     }
 
+  /* A protective MBR has an entry of type 0xee covering the
+     device.  Any other entries in it, as in a "hybrid" MBR, only
+     duplicate partitions in the GPT. */
+  if (sector == 0)
+    for (i = 0; i < sizeof pt->partitions / sizeof *pt->partitions; i++)
+      if (pt->partitions[i].type == 0xee)
+        {
+          free (pt);
+          read_gpt (s);
+          return;
+        }
+
   /* Parse partitions. */
   for (i = 0; i < sizeof pt->partitions / sizeof *pt->partitions; i++)
     {
@@ -116,8 +207,20 @@ read_partition_table (struct block *block, block_sector_t sector,
                || e->type == 0x85    /* Linux extended partition. */
                || e->type == 0xc5)   /* DR-DOS extended partition. */
         {
+          struct extended_table *x;
+
           printf ("%s: Extended partition in sector %"PRDSNu"\n",
                   block_name (block), sector);
+          if (s->extended_cnt >= MAX_EXTENDED)
+            {
+              printf ("%s: Too many extended partitions\n",
+                      block_name (block));
+              continue;
+            }
+
+          /* Queue the extended partition table for
+             partition_scan() to read after this one. */
+          x = &s->extended[s->extended_cnt++];
 
           /* The interpretation of the offset field for extended
              partitions is bizarre.  When the extended partition
@@ -128,32 +231,290 @@ read_partition_table (struct block *block, block_sector_t sector,
              is nested, the offset is relative to the start of
              the extended partition that the MBR points to. */
           if (sector == 0)
-            read_partition_table (block, e->offset, e->offset, part_nr);
+            x->sector = x->primary = e->offset;
           else
-            read_partition_table (block, e->offset + primary_extended_sector,
-                                  primary_extended_sector, part_nr);
+            {
+              x->sector = e->offset + primary_extended_sector;
+              x->primary = primary_extended_sector;
+            }
         }
       else
         {
-          ++*part_nr;
+          enum block_type type = (e->type == 0x20 ? BLOCK_KERNEL
+                                  : e->type == 0x21 ? BLOCK_FILESYS
+                                  : e->type == 0x22 ? BLOCK_SCRATCH
+                                  : e->type == 0x23 ? BLOCK_SWAP
+                                  : BLOCK_FOREIGN);
+          char extra_info[128];
 
-          found_partition (block, e->type, e->offset + sector,
-                           e->size, *part_nr);
+          ++s->part_nr;
+          snprintf (extra_info, sizeof extra_info, "%s (%02x)",
+                    partition_type_name (e->type), e->type);
+          found_partition (block, type, e->offset + sector, e->size,
+                           s->part_nr, extra_info);
         }
     }
 
   free (pt);
 }
 
-/* We have found a primary or logical partition of the given TYPE
-   on BLOCK, starting at sector START and continuing for SIZE
-   sectors, which we are giving the partition number PART_NR.
-   Check whether this is a partition of interest to Pintos, and
-   if so then add it to the proper element of partitions[]. */
+/* A GUID, as stored in a GUID partition table, with its first
+   three fields little-endian. */
+struct guid
+  {
+    uint32_t data1;
+    uint16_t data2;
+    uint16_t data3;
+    uint8_t data4[8];
+  }
+PACKED;
+
+/* GPT header, in sector 1 and, as a backup, in the last sector of
+   a device.  See [UEFI] section 5.3. */
+struct gpt_header
+  {
+    uint64_t signature;         /* GPT_SIGNATURE. */
+    uint32_t revision;          /* Version of the format. */
+    uint32_t header_size;       /* Bytes covered by HEADER_CRC. */
+    uint32_t header_crc;        /* CRC32 of header with this field 0. */
+    uint32_t reserved;          /* Must be 0. */
+    uint64_t my_lba;            /* Sector holding this header. */
+    uint64_t alternate_lba;     /* Sector holding the other header. */
+    uint64_t first_usable_lba;  /* First sector for partitions. */
+    uint64_t last_usable_lba;   /* Last sector for partitions. */
+    struct guid disk_guid;      /* Identifies the device. */
+    uint64_t entries_lba;       /* First sector of the entry array. */
+    uint32_t entry_cnt;         /* Number of entries in the array. */
+    uint32_t entry_size;        /* Bytes per entry. */
+    uint32_t entries_crc;       /* CRC32 of the entry array. */
+    uint8_t unused[420];        /* Reserved, to the end of the sector. */
+  }
+PACKED;
+
+/* "EFI PART", read as a little-endian integer. */
+#define GPT_SIGNATURE 0x5452415020494645ULL
+
+/* GPT partition entry.  An entry may be longer than this, as
+   given by the header's ENTRY_SIZE. */
+struct gpt_entry
+  {
+    struct guid type;           /* Partition type, or zero if unused. */
+    struct guid unique;         /* Identifies the partition. */
+    uint64_t first_lba;         /* First sector. */
+    uint64_t last_lba;          /* Last sector, inclusive. */
+    uint64_t attributes;        /* Attribute flags. */
+    uint16_t name[36];          /* Name, in UTF-16LE. */
+  }
+PACKED;
+
+/* GPT partition types that we know. */
+struct gpt_type
+  {
+    struct guid guid;           /* Type GUID. */
+    enum block_type type;       /* Role the partition plays in Pintos. */
+    const char *name;           /* Human-readable name. */
+  };
+
+static const struct gpt_type gpt_types[] =
+  {
+    /* Pintos's own types, which end in the corresponding MBR
+       partition type. */
+    {{0x50494e54, 0x4f53, 0x4000, {0x80, 0, 0, 0, 0, 0, 0, 0x20}},
+     BLOCK_KERNEL, "Pintos OS kernel"},
+    {{0x50494e54, 0x4f53, 0x4000, {0x80, 0, 0, 0, 0, 0, 0, 0x21}},
+     BLOCK_FILESYS, "Pintos file system"},
+    {{0x50494e54, 0x4f53, 0x4000, {0x80, 0, 0, 0, 0, 0, 0, 0x22}},
+     BLOCK_SCRATCH, "Pintos scratch"},
+    {{0x50494e54, 0x4f53, 0x4000, {0x80, 0, 0, 0, 0, 0, 0, 0x23}},
+     BLOCK_SWAP, "Pintos swap"},
+
+    {{0xc12a7328, 0xf81f, 0x11d2,
+      {0xba, 0x4b, 0x00, 0xa0, 0xc9, 0x3e, 0xc9, 0x3b}},
+     BLOCK_FOREIGN, "EFI System"},
+    {{0x21686148, 0x6449, 0x6e6f,
+      {0x74, 0x4e, 0x65, 0x65, 0x64, 0x45, 0x46, 0x49}},
+     BLOCK_FOREIGN, "BIOS boot"},
+    {{0xebd0a0a2, 0xb9e5, 0x4433,
+      {0x87, 0xc0, 0x68, 0xb6, 0xb7, 0x26, 0x99, 0xc7}},
+     BLOCK_FOREIGN, "Microsoft basic data"},
+    {{0x0fc63daf, 0x8483, 0x4772,
+      {0x8e, 0x79, 0x3d, 0x69, 0xd8, 0x47, 0x7d, 0xe4}},
+     BLOCK_FOREIGN, "Linux filesystem"},
+    {{0x0657fd6d, 0xa4ab, 0x43c4,
+      {0x84, 0xe5, 0x09, 0x33, 0xc8, 0x4b, 0x4f, 0x4f}},
+     BLOCK_FOREIGN, "Linux swap"},
+    {{0xe6d6d379, 0xf507, 0x44c2,
+      {0xa2, 0x3c, 0x23, 0x8f, 0x2a, 0x3d, 0xf9, 0x28}},
+     BLOCK_FOREIGN, "Linux LVM"},
+  };
+#define GPT_TYPE_CNT (sizeof gpt_types / sizeof *gpt_types)
+
+/* Returns the CRC-32 of the SIZE bytes in BUF, as used in GPTs
+   (and Ethernet, zlib, and many others). */
+static uint32_t
+crc32 (const void *buf_, size_t size)
+{
+  const uint8_t *buf = buf_;
+  uint32_t crc = 0xffffffff;
+
+  while (size-- > 0)
+    {
+      int i;
+
+      crc ^= *buf++;
+      for (i = 0; i < 8; i++)
+        crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  return ~crc;
+}
+
+/* Reads the GPT header in SECTOR of the device that S is scanning
+   into H.  Returns true if it is valid, false otherwise. */
+static bool
+read_gpt_header (struct scan *s, block_sector_t sector,
+                 struct gpt_header *h)
+{
+  uint32_t crc;
+  bool ok;
+
+  ASSERT (sizeof *h == BLOCK_SECTOR_SIZE);
+  read_sectors (s, sector, 1, h);
+  if (h->signature != GPT_SIGNATURE
+      || h->header_size < offsetof (struct gpt_header, unused)
+      || h->header_size > sizeof *h
+      || h->my_lba != sector)
+    return false;
+
+  crc = h->header_crc;
+  h->header_crc = 0;
+  ok = crc32 (h, h->header_size) == crc;
+  h->header_crc = crc;
+  return ok;
+}
+
+/* Reads the entry array that H describes from the device that S
+   is scanning.  Returns the array, which the caller must free, or
+   a null pointer if it is invalid. */
+static uint8_t *
+read_gpt_entries (struct scan *s, const struct gpt_header *h)
+{
+  size_t size = (size_t) h->entry_cnt * h->entry_size;
+  block_sector_t sector_cnt = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+  uint8_t *entries;
+
+  if (h->entry_size < sizeof (struct gpt_entry)
+      || h->entry_size % 8 != 0
+      || h->entry_cnt > GPT_MAX_SECTORS * BLOCK_SECTOR_SIZE / h->entry_size
+      || h->entries_lba >= block_size (s->block)
+      || sector_cnt > block_size (s->block) - h->entries_lba)
+    return NULL;
+
+  entries = malloc (sector_cnt * BLOCK_SECTOR_SIZE);
+  if (entries == NULL)
+    PANIC ("Failed to allocate memory for partition table.");
+  read_sectors (s, h->entries_lba, sector_cnt, entries);
+  if (crc32 (entries, size) != h->entries_crc)
+    {
+      free (entries);
+      return NULL;
+    }
+  return entries;
+}
+
+/* Copies the name of GPT entry E into NAME, which has room for
+   SIZE bytes, replacing characters other than printable ASCII by
+   `?'. */
+static void
+gpt_entry_name (const struct gpt_entry *e, char *name, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i + 1 < size && i < sizeof e->name / sizeof *e->name; i++)
+    {
+      uint16_t c = e->name[i];
+      if (c == 0)
+        break;
+      name[i] = c >= 0x20 && c < 0x7f ? c : '?';
+    }
+  name[i] = '\0';
+}
+
+/* Scans the GUID partition table on the device that S is scanning
+   for partitions of interest to Pintos, falling back to the
+   backup copy in the last sector if the primary one is damaged.
+   Partitions are numbered by their slots in the table. */
+static void
+read_gpt (struct scan *s)
+{
+  static const struct guid unused_type;
+  struct block *block = s->block;
+  struct gpt_header *h;
+  uint8_t *entries = NULL;
+  uint32_t i;
+
+  h = malloc (sizeof *h);
+  if (h == NULL)
+    PANIC ("Failed to allocate memory for partition table.");
+  if (read_gpt_header (s, 1, h))
+    entries = read_gpt_entries (s, h);
+  if (entries == NULL)
+    {
+      printf ("%s: Invalid primary GUID partition table, "
+              "trying backup\n", block_name (block));
+      if (read_gpt_header (s, block_size (block) - 1, h))
+        entries = read_gpt_entries (s, h);
+      if (entries == NULL)
+        {
+          printf ("%s: Invalid GUID partition table\n", block_name (block));
+          free (h);
+          return;
+        }
+    }
+
+  for (i = 0; i < h->entry_cnt; i++)
+    {
+      const struct gpt_entry *e = (const struct gpt_entry *)
+                                  (entries + i * h->entry_size);
+      const struct gpt_type *t;
+      char extra_info[128];
+      char name[37];
+
+      if (!memcmp (&e->type, &unused_type, sizeof e->type))
+        continue;
+      for (t = gpt_types; t < gpt_types + GPT_TYPE_CNT; t++)
+        if (!memcmp (&e->type, &t->guid, sizeof e->type))
+          break;
+
+      s->part_nr++;
+      gpt_entry_name (e, name, sizeof name);
+      snprintf (extra_info, sizeof extra_info, "%s%s%s%s",
+                t < gpt_types + GPT_TYPE_CNT ? t->name : "Unknown",
+                name[0] != '\0' ? " \"" : "", name,
+                name[0] != '\0' ? "\"" : "");
+      if (e->first_lba > e->last_lba || e->last_lba >= UINT32_MAX)
+        printf ("%s%"PRIu32": Partition is past end of device\n",
+                block_name (block), i + 1);
+      else
+        found_partition (block,
+                         t < gpt_types + GPT_TYPE_CNT
+                         ? t->type : BLOCK_FOREIGN,
+                         e->first_lba, e->last_lba - e->first_lba + 1,
+                         i + 1, extra_info);
+    }
+
+  free (entries);
+  free (h);
+}
+
+/* We have found a primary or logical partition on BLOCK, starting
+   at sector START and continuing for SIZE sectors, which we are
+   giving the partition number PART_NR.  Check whether it is
+   within BLOCK, and if so register it as a block device of the
+   given TYPE, printing EXTRA_INFO about it. */
 static void
-found_partition (struct block *block, uint8_t part_type,
+found_partition (struct block *block, enum block_type type,
                  block_sector_t start, block_sector_t size,
-                 int part_nr)
+                 int part_nr, const char *extra_info)
 {
   if (start >= block_size (block))
     printf ("%s%d: Partition starts past end of device (sector %"PRDSNu")\n",
@@ -163,13 +524,7 @@ found_partition (struct block *block, uint8_t part_type,
             block_name (block), part_nr, start + size, block_size (block));
   else
     {
-      enum block_type type = (part_type == 0x20 ? BLOCK_KERNEL
-                              : part_type == 0x21 ? BLOCK_FILESYS
-                              : part_type == 0x22 ? BLOCK_SCRATCH
-                              : part_type == 0x23 ? BLOCK_SWAP
-                              : BLOCK_FOREIGN);
       struct partition *p;
-      char extra_info[128];
       char name[16];
 
       p = malloc (sizeof *p);
@@ -179,8 +534,6 @@ found_partition (struct block *block, uint8_t part_type,
       p->start = start;
 
       snprintf (name, sizeof name, "%s%d", block_name (block), part_nr);
-      snprintf (extra_info, sizeof extra_info, "%s (%02x)",
-                partition_type_name (part_type), part_type);
       block_register (name, type, extra_info, size, &partition_operations, p);
     }
 }
@@ -317,8 +670,40 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads the CNT sectors starting at SECTOR from partition P into
+   BUFFER as a single request to the underlying device. */
+static void
+partition_read_multiple (void *p_, block_sector_t sector,
+                         block_sector_t cnt, void *buffer)
+{
+  struct partition *p = p_;
+  block_read_multiple (p->block, p->start + sector, cnt, buffer);
+}
+
+/* Writes the CNT sectors starting at SECTOR to partition P from
+   BUFFER as a single request to the underlying device. */
+static void
+partition_write_multiple (void *p_, block_sector_t sector,
+                          block_sector_t cnt, const void *buffer)
+{
+  struct partition *p = p_;
+  block_write_multiple (p->block, p->start + sector, cnt, buffer);
+}
+
+/* Passes request R, to partition P, to the underlying device. */
+static void
+partition_submit (void *p_, struct block_request *r)
+{
+  struct partition *p = p_;
+  r->sector += p->start;
+  block_forward (p->block, r);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multiple,
+    partition_write_multiple,
+    partition_submit
   };
@@ -0,0 +1,81 @@
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+
+/* This code reads and writes PCI configuration space with
+   configuration mechanism #1, which every PCI host bridge we care
+   about supports.  See [PCI] chapter 3.2.2.3.2. */
+
+/* Configuration mechanism #1 I/O ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8        /* Selects a register. */
+#define PCI_CONFIG_DATA 0xcfc           /* Reads or writes it. */
+
+/* Selects register REG of the function at A for access through
+   PCI_CONFIG_DATA. */
+static void
+select_register (const struct pci_address *a, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDRESS, (0x80000000 | (a->bus << 16) | (a->slot << 11)
+                             | (a->func << 8) | (reg & 0xfc)));
+}
+
+/* Returns the 32-bit configuration register REG, which must be a
+   multiple of 4, of the function at A. */
+uint32_t
+pci_read_config (const struct pci_address *a, uint8_t reg)
+{
+  enum intr_level old_level = intr_disable ();
+  uint32_t value;
+
+  select_register (a, reg);
+  value = inl (PCI_CONFIG_DATA);
+  intr_set_level (old_level);
+  return value;
+}
+
+/* Writes VALUE to the 32-bit configuration register REG, which
+   must be a multiple of 4, of the function at A. */
+void
+pci_write_config (const struct pci_address *a, uint8_t reg, uint32_t value)
+{
+  enum intr_level old_level = intr_disable ();
+
+  select_register (a, reg);
+  outl (PCI_CONFIG_DATA, value);
+  intr_set_level (old_level);
+}
+
+/* Searches every PCI bus for a function of the given CLASS and
+   SUBCLASS.  If one is found, stores its location in *A and
+   returns true.  Otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_address *a)
+{
+  unsigned bus, slot, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (slot = 0; slot < 32; slot++)
+      {
+        unsigned func_cnt = 1;
+
+        for (func = 0; func < func_cnt; func++)
+          {
+            uint32_t class_reg;
+
+            a->bus = bus;
+            a->slot = slot;
+            a->func = func;
+            if ((pci_read_config (a, PCI_REG_ID) & 0xffff) == 0xffff)
+              continue;
+            if (func == 0
+                && (pci_read_config (a, PCI_REG_HEADER) & 0x800000) != 0)
+              func_cnt = 8;
+
+            class_reg = pci_read_config (a, PCI_REG_CLASS);
+            if ((class_reg >> 24) == class
+                && ((class_reg >> 16) & 0xff) == subclass)
+              return true;
+          }
+      }
+  return false;
+}
@@ -0,0 +1,146 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in memory.  Its contents are lost at
+   shutdown, but it costs no device time, so running the same
+   work on a RAM disk and on a real disk separates the cost of the
+   code above the block layer from the cost of the device.
+
+   The sectors live in pages from the user pool, which is usually
+   much larger than the kernel pool and otherwise idle while the
+   kernel is busy with I/O.  The pages need not be contiguous. */
+struct ramdisk
+  {
+    uint8_t **pages;                    /* The pages holding sectors. */
+  };
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block_operations ramdisk_operations;
+
+/* Copies the CNT sectors starting at SECTOR of RAM disk R to
+   BUFFER, or from BUFFER if WRITE is true. */
+static void
+ramdisk_transfer (struct ramdisk *r, bool write, block_sector_t sector,
+                  block_sector_t cnt, uint8_t *buffer)
+{
+  while (cnt > 0)
+    {
+      uint8_t *page = r->pages[sector / SECTORS_PER_PAGE];
+      size_t ofs = sector % SECTORS_PER_PAGE;
+      block_sector_t n = SECTORS_PER_PAGE - ofs;
+
+      if (n > cnt)
+        n = cnt;
+      if (write)
+        memcpy (page + ofs * BLOCK_SECTOR_SIZE, buffer,
+                n * BLOCK_SECTOR_SIZE);
+      else
+        memcpy (buffer, page + ofs * BLOCK_SECTOR_SIZE,
+                n * BLOCK_SECTOR_SIZE);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Reads sector SECTOR from RAM disk R into BUFFER. */
+static void
+ramdisk_read (void *r, block_sector_t sector, void *buffer)
+{
+  ramdisk_transfer (r, false, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to RAM disk R from BUFFER. */
+static void
+ramdisk_write (void *r, block_sector_t sector, const void *buffer)
+{
+  ramdisk_transfer (r, true, sector, 1, (void *) buffer);
+}
+
+/* Reads the CNT sectors starting at SECTOR from RAM disk R into
+   BUFFER. */
+static void
+ramdisk_read_multiple (void *r, block_sector_t sector, block_sector_t cnt,
+                       void *buffer)
+{
+  ramdisk_transfer (r, false, sector, cnt, buffer);
+}
+
+/* Writes the CNT sectors starting at SECTOR to RAM disk R from
+   BUFFER. */
+static void
+ramdisk_write_multiple (void *r, block_sector_t sector, block_sector_t cnt,
+                        const void *buffer)
+{
+  ramdisk_transfer (r, true, sector, cnt, (void *) buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL
+  };
+
+/* Creates and registers a zero-filled RAM disk named NAME with
+   SIZE sectors, of the given TYPE.  Panics if there is not enough
+   memory.  Returns the new device. */
+struct block *
+ramdisk_create (const char *name, enum block_type type, block_sector_t size)
+{
+  size_t page_cnt = DIV_ROUND_UP (size, SECTORS_PER_PAGE);
+  struct ramdisk *r;
+  size_t i;
+
+  ASSERT (size > 0);
+
+  r = malloc (sizeof *r);
+  if (r != NULL)
+    r->pages = malloc (page_cnt * sizeof *r->pages);
+  if (r == NULL || r->pages == NULL)
+    PANIC ("%s: out of memory", name);
+  for (i = 0; i < page_cnt; i++)
+    {
+      r->pages[i] = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (r->pages[i] == NULL)
+        PANIC ("%s: not enough memory for %zu pages", name, page_cnt);
+    }
+
+  return block_register (name, type, "RAM disk", size,
+                         &ramdisk_operations, r);
+}
+
+/* Copies as much of SRC into RAMDISK as fits, a page at a time,
+   so that RAMDISK starts out as a copy of SRC. */
+void
+ramdisk_load (struct block *ramdisk, struct block *src)
+{
+  block_sector_t size = block_size (ramdisk);
+  block_sector_t sector;
+  void *buffer;
+
+  if (size > block_size (src))
+    size = block_size (src);
+  printf ("%s: loading %"PRDSNu" sectors from %s\n",
+          block_name (ramdisk), size, block_name (src));
+
+  buffer = palloc_get_page (PAL_ASSERT);
+  for (sector = 0; sector < size; sector += SECTORS_PER_PAGE)
+    {
+      block_sector_t cnt = (size - sector < SECTORS_PER_PAGE
+                            ? size - sector : SECTORS_PER_PAGE);
+      block_read_multiple (src, sector, cnt, buffer);
+      block_write_multiple (ramdisk, sector, cnt, buffer);
+    }
+  palloc_free_page (buffer);
+}
@@ -0,0 +1,10 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include "devices/block.h"
+
+struct block *ramdisk_create (const char *name, enum block_type,
+                              block_sector_t size);
+void ramdisk_load (struct block *ramdisk, struct block *src);
+
+#endif /* devices/ramdisk.h */
@@ -0,0 +1,298 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+
+/* A virtual block device built from other block devices, its
+   members.
+
+   A striped device divides its sectors into chunks and deals them
+   out to its members in turn, so that a large transfer keeps
+   several members busy at once.  Each member contributes as many
+   whole chunks as fit in the smallest one.
+
+   A concatenated device, whose chunk size is 0, puts its members
+   one after another, so that it is as big as all of them
+   together. */
+struct stripe
+  {
+    size_t cnt;                         /* Number of members. */
+    block_sector_t chunk;               /* Sectors per chunk, or 0. */
+    struct member
+      {
+        struct block *block;            /* Member device. */
+        block_sector_t start;           /* Concatenation: first sector
+                                           of the virtual device that
+                                           maps to this member. */
+      }
+    members[];
+  };
+
+/* A request to a stripe that spans more than one member, split
+   into one request per piece. */
+struct split
+  {
+    struct block_request *parent;       /* Original request. */
+    size_t pending;                     /* Pieces not yet complete. */
+    struct block_request pieces[];      /* The pieces. */
+  };
+
+static struct block_operations stripe_operations;
+
+/* Finds where SECTOR of stripe S is stored.  Stores the member in
+   *MEMBER and the sector within it in *MEMBER_SECTOR, and returns
+   the number of sectors from SECTOR on that are stored after it
+   on the same member, including SECTOR itself. */
+static block_sector_t
+map_sector (const struct stripe *s, block_sector_t sector,
+            struct block **member, block_sector_t *member_sector)
+{
+  if (s->chunk > 0)
+    {
+      block_sector_t chunk_no = sector / s->chunk;
+      block_sector_t ofs = sector % s->chunk;
+
+      *member = s->members[chunk_no % s->cnt].block;
+      *member_sector = chunk_no / s->cnt * s->chunk + ofs;
+      return s->chunk - ofs;
+    }
+  else
+    {
+      size_t i = s->cnt - 1;
+
+      while (sector < s->members[i].start)
+        i--;
+      *member = s->members[i].block;
+      *member_sector = sector - s->members[i].start;
+      return block_size (*member) - *member_sector;
+    }
+}
+
+/* Returns the number of pieces, each stored contiguously on one
+   member, in the CNT sectors starting at SECTOR of stripe S. */
+static size_t
+count_pieces (const struct stripe *s, block_sector_t sector,
+              block_sector_t cnt)
+{
+  size_t piece_cnt = 0;
+
+  while (cnt > 0)
+    {
+      struct block *member;
+      block_sector_t member_sector;
+      block_sector_t n = map_sector (s, sector, &member, &member_sector);
+
+      if (n > cnt)
+        n = cnt;
+      sector += n;
+      cnt -= n;
+      piece_cnt++;
+    }
+  return piece_cnt;
+}
+
+/* Transfers the CNT sectors starting at SECTOR between stripe S
+   and BUFFER, one piece at a time, writing to S if WRITE is true
+   and reading from it otherwise. */
+static void
+stripe_transfer (struct stripe *s, bool write, block_sector_t sector,
+                 block_sector_t cnt, uint8_t *buffer)
+{
+  while (cnt > 0)
+    {
+      struct block *member;
+      block_sector_t member_sector;
+      block_sector_t n = map_sector (s, sector, &member, &member_sector);
+
+      if (n > cnt)
+        n = cnt;
+      if (write)
+        block_write_multiple (member, member_sector, n, buffer);
+      else
+        block_read_multiple (member, member_sector, n, buffer);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Reads sector SECTOR from stripe S into BUFFER. */
+static void
+stripe_read (void *s, block_sector_t sector, void *buffer)
+{
+  stripe_transfer (s, false, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to stripe S from BUFFER. */
+static void
+stripe_write (void *s, block_sector_t sector, const void *buffer)
+{
+  stripe_transfer (s, true, sector, 1, (void *) buffer);
+}
+
+/* Reads the CNT sectors starting at SECTOR from stripe S into
+   BUFFER. */
+static void
+stripe_read_multiple (void *s, block_sector_t sector, block_sector_t cnt,
+                      void *buffer)
+{
+  stripe_transfer (s, false, sector, cnt, buffer);
+}
+
+/* Writes the CNT sectors starting at SECTOR to stripe S from
+   BUFFER. */
+static void
+stripe_write_multiple (void *s, block_sector_t sector, block_sector_t cnt,
+                       const void *buffer)
+{
+  stripe_transfer (s, true, sector, cnt, (void *) buffer);
+}
+
+/* Completes PIECE of a split request, and the request itself once
+   all of its pieces are done.  Pieces may complete at the same
+   time in different members' worker threads. */
+static void
+piece_done (struct block_request *piece)
+{
+  struct split *split = piece->aux;
+  struct block_request *parent = split->parent;
+  enum intr_level old_level;
+  bool last;
+
+  old_level = intr_disable ();
+  last = --split->pending == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    {
+      free (split);
+      block_complete (parent);
+    }
+}
+
+/* Starts request R to stripe S by submitting each of its pieces
+   to the member that stores it, so that the members work on them
+   at the same time. */
+static void
+stripe_submit (void *s_, struct block_request *r)
+{
+  struct stripe *s = s_;
+  size_t piece_cnt = count_pieces (s, r->sector, r->cnt);
+  struct block *member;
+  block_sector_t member_sector;
+  struct split *split;
+  uint8_t *buffer;
+  block_sector_t sector, cnt;
+  size_t i;
+
+  if (piece_cnt == 1)
+    {
+      map_sector (s, r->sector, &member, &member_sector);
+      r->sector = member_sector;
+      block_forward (member, r);
+      return;
+    }
+
+  split = malloc (sizeof *split + piece_cnt * sizeof *split->pieces);
+  if (split == NULL)
+    {
+      /* Fall back to one piece at a time. */
+      stripe_transfer (s, r->write, r->sector, r->cnt, r->buffer);
+      block_complete (r);
+      return;
+    }
+  split->parent = r;
+  split->pending = piece_cnt;
+
+  /* SPLIT stays allocated until every piece has completed, which
+     cannot happen before the last one is submitted, but after
+     that it may already be gone. */
+  buffer = r->buffer;
+  sector = r->sector;
+  cnt = r->cnt;
+  for (i = 0; i < piece_cnt; i++)
+    {
+      struct block_request *piece = &split->pieces[i];
+      block_sector_t n = map_sector (s, sector, &member, &member_sector);
+
+      if (n > cnt)
+        n = cnt;
+      piece->write = r->write;
+      piece->sector = member_sector;
+      piece->cnt = n;
+      piece->buffer = buffer;
+      piece->complete = piece_done;
+      piece->aux = split;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+      block_submit (member, piece);
+    }
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multiple,
+    stripe_write_multiple,
+    stripe_submit
+  };
+
+/* Creates and registers a block device named NAME from the CNT
+   block devices in MEMBERS, striping them in CHUNK-sector chunks,
+   or concatenating them if CHUNK is 0.  The members should not be
+   used directly afterward.  Returns the new device. */
+struct block *
+stripe_create (const char *name, struct block **members, size_t cnt,
+               block_sector_t chunk)
+{
+  struct stripe *s;
+  block_sector_t size;
+  char extra_info[128];
+  size_t i;
+
+  ASSERT (cnt > 0);
+
+  s = malloc (sizeof *s + cnt * sizeof *s->members);
+  if (s == NULL)
+    PANIC ("Failed to allocate memory for %s", name);
+  s->cnt = cnt;
+  s->chunk = chunk;
+
+  /* Lay out the members. */
+  size = 0;
+  if (chunk > 0)
+    {
+      block_sector_t min_size = block_size (members[0]);
+
+      for (i = 1; i < cnt; i++)
+        if (block_size (members[i]) < min_size)
+          min_size = block_size (members[i]);
+      size = min_size / chunk * chunk * cnt;
+    }
+  for (i = 0; i < cnt; i++)
+    {
+      s->members[i].block = members[i];
+      s->members[i].start = size;
+      if (chunk == 0)
+        size += block_size (members[i]);
+    }
+  if (size == 0)
+    PANIC ("%s: members are too small", name);
+
+  /* Describe the layout, e.g. "striped over hda2, hdc1". */
+  snprintf (extra_info, sizeof extra_info, "%s over",
+            chunk > 0 ? "striped" : "concatenated");
+  for (i = 0; i < cnt; i++)
+    {
+      size_t len = strlen (extra_info);
+      snprintf (extra_info + len, sizeof extra_info - len, "%s %s",
+                i > 0 ? "," : "", block_name (members[i]));
+    }
+
+  return block_register (name, BLOCK_RAW, extra_info, size,
+                         &stripe_operations, s);
+}
@@ -0,0 +1,13 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Sectors in each chunk of a striped device. */
+#define STRIPE_CHUNK 64
+
+struct block *stripe_create (const char *name, struct block **members,
+                             size_t cnt, block_sector_t chunk);
+
+#endif /* devices/stripe.h */
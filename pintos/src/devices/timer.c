@@ -24,6 +24,12 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Time-stamp counter and timer ticks when timer_calibrate()
+   finished, from which timer_cycles_to_us() measures the rate
+   at which the time-stamp counter advances. */
+static uint64_t calibrate_cycles;
+static int64_t calibrate_ticks;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
@@ -64,6 +70,9 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  calibrate_cycles = timer_cycles ();
+  calibrate_ticks = timer_ticks ();
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -84,6 +93,34 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the CPU's time-stamp counter, which counts processor
+   cycles.  It is much finer-grained than timer_ticks(), so it
+   suits timing short operations. */
+uint64_t
+timer_cycles (void) 
+{
+  uint64_t cycles;
+  asm volatile ("rdtsc" : "=A" (cycles));
+  return cycles;
+}
+
+/* Converts CYCLES of the time-stamp counter to microseconds,
+   at the rate it has advanced since timer_calibrate().  Returns
+   0 if less than a timer tick has passed since then. */
+uint64_t
+timer_cycles_to_us (uint64_t cycles) 
+{
+  int64_t elapsed = timer_elapsed (calibrate_ticks);
+  uint64_t cycles_per_tick;
+
+  if (elapsed <= 0)
+    return 0;
+  cycles_per_tick = (timer_cycles () - calibrate_cycles) / elapsed;
+  if (cycles_per_tick == 0)
+    return 0;
+  return cycles * (1000000 / TIMER_FREQ) / cycles_per_tick;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -0,0 +1,21 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Directory entry cache.
+
+   Maps a (directory inode sector, name) pair to the inode sector
+   of the named file, or to 0 for a name known not to exist, so
+   that repeated lookups of the same names do not re-read
+   directory sectors.  directory.c keeps it coherent. */
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sector);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t sector);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
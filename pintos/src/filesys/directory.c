@@ -1,7 +1,9 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
-#include <list.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -21,21 +23,76 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Directory entries never straddle a sector boundary: every
+   sector of a directory holds ENTRIES_PER_SECTOR entries,
+   followed by a few unused bytes.
+
+   A small directory uses the "linear" format, in which an entry
+   may be in any sector, so that a lookup scans each sector in
+   turn.  Once a linear directory would need more than
+   LINEAR_MAX_SECTORS sectors, it is converted to the "hashed"
+   format, in which sector B holds just the entries whose names
+   hash to bucket B, so that a lookup reads a single sector no
+   matter how large the directory grows.  When an insertion finds
+   its bucket full, the number of buckets doubles and all the
+   entries are redistributed.  The number of buckets is kept in
+   the directory's inode, with 0 meaning the linear format.
+
+   Each directory operation holds the lock in the directory's
+   inode, for reading if it only looks at the entries and for
+   writing if it changes them, so that lookups never see a
+   directory halfway through being rehashed.  Removing a
+   directory also locks the directory being removed, always
+   after its parent. */
+#define ENTRIES_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define LINEAR_MAX_SECTORS 2    /* Largest linear directory. */
+#define MIN_BUCKETS 8           /* Buckets in a newly hashed directory. */
+#define MAX_BUCKETS 4096        /* Most buckets in a directory. */
+
+/* One sector's worth of directory entries. */
+struct dir_sector
+  {
+    struct dir_entry entries[ENTRIES_PER_SECTOR];
+    uint8_t unused[BLOCK_SECTOR_SIZE
+                   - ENTRIES_PER_SECTOR * sizeof (struct dir_entry)];
+  };
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory is in sector PARENT.  The
+   new directory holds just the entries "." and "..", for itself
+   and for PARENT.  The root directory is its own parent.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t sector_cnt = DIV_ROUND_UP (entry_cnt + 2, ENTRIES_PER_SECTOR);
+  struct dir *dir;
+  bool success;
+
+  if (!inode_create (sector, sector_cnt * BLOCK_SECTOR_SIZE, true))
+    return false;
+
+  /* A removed directory's sector may be reused for this one.  The
+     removed directory was empty, so the only names the directory
+     entry cache can still hold for SECTOR are "." and "..", which
+     adding them here brings up to date, and negative entries,
+     which are right for an empty directory too. */
+  dir = dir_open (inode_open (sector));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector)
+             && dir_add (dir, "..", parent));
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
-   it takes ownership.  Returns a null pointer on failure. */
+   it takes ownership.  Returns a null pointer on failure,
+   including when INODE is not a directory. */
 struct dir *
 dir_open (struct inode *inode) 
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL && inode_is_dir (inode))
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -83,6 +140,64 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the byte offset of entry IDX in sector SECTOR_IDX of a
+   directory. */
+static off_t
+entry_ofs (size_t sector_idx, size_t idx)
+{
+  return sector_idx * BLOCK_SECTOR_SIZE + idx * sizeof (struct dir_entry);
+}
+
+/* Returns the number of sectors in DIR. */
+static size_t
+dir_sector_cnt (const struct dir *dir)
+{
+  return DIV_ROUND_UP (inode_length (dir->inode), BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the hash bucket for NAME in a directory with
+   BUCKET_CNT buckets, which must be a power of 2. */
+static size_t
+name_to_bucket (const char *name, unsigned bucket_cnt)
+{
+  return hash_string (name) & (bucket_cnt - 1);
+}
+
+/* Reads sector SECTOR_IDX of DIR into DS.  A sector at or past
+   the end of DIR reads as all free entries.  Returns false if an
+   error occurs. */
+static bool
+read_dir_sector (const struct dir *dir, size_t sector_idx,
+                 struct dir_sector *ds)
+{
+  off_t ofs = sector_idx * BLOCK_SECTOR_SIZE;
+  off_t length = inode_length (dir->inode);
+  off_t size = length - ofs;
+
+  if (size > BLOCK_SECTOR_SIZE)
+    size = BLOCK_SECTOR_SIZE;
+  else if (size < 0)
+    size = 0;
+  memset ((uint8_t *) ds + size, 0, BLOCK_SECTOR_SIZE - size);
+  return inode_read_at (dir->inode, ds, size, ofs) == size;
+}
+
+/* Writes the COUNT entries in ENTRIES to sector SECTOR_IDX of
+   DIR, with the rest of the sector's entries free.  DS is
+   scratch space.  Returns true if successful. */
+static bool
+write_dir_sector (struct dir *dir, size_t sector_idx,
+                  const struct dir_entry *entries, size_t count,
+                  struct dir_sector *ds)
+{
+  ASSERT (count <= ENTRIES_PER_SECTOR);
+  memset (ds, 0, sizeof *ds);
+  memcpy (ds->entries, entries, count * sizeof *entries);
+  return (inode_write_at (dir->inode, ds, sizeof *ds,
+                          sector_idx * BLOCK_SECTOR_SIZE)
+          == sizeof *ds);
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -92,56 +207,314 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_sector *ds;
+  unsigned bucket_cnt;
+  size_t sector_idx, end_idx;
+  bool found = false;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
+  ds = malloc (sizeof *ds);
+  if (ds == NULL)
+    return false;
+
+  /* A hashed directory keeps NAME in a single sector.  A linear
+     directory may have it anywhere. */
+  bucket_cnt = inode_dir_buckets (dir->inode);
+  if (bucket_cnt != 0)
+    {
+      sector_idx = name_to_bucket (name, bucket_cnt);
+      end_idx = sector_idx + 1;
+    }
+  else
+    {
+      sector_idx = 0;
+      end_idx = dir_sector_cnt (dir);
+    }
+
+  for (; !found && sector_idx < end_idx
+         && read_dir_sector (dir, sector_idx, ds); sector_idx++)
+    {
+      size_t i;
+
+      for (i = 0; i < ENTRIES_PER_SECTOR; i++)
+        {
+          struct dir_entry *e = &ds->entries[i];
+          if (e->in_use && !strcmp (name, e->name)) 
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = entry_ofs (sector_idx, i);
+              found = true;
+              break;
+            }
+        }
+    }
+  free (ds);
+  return found;
+}
+
+/* Searches sector SECTOR_IDX of DIR for a free entry, using DS
+   as scratch space.  If one is found, stores its byte offset in
+   *OFSP and returns true; otherwise, returns false. */
+static bool
+find_free_entry (const struct dir *dir, size_t sector_idx,
+                 struct dir_sector *ds, off_t *ofsp)
+{
+  size_t i;
+
+  if (!read_dir_sector (dir, sector_idx, ds))
+    return false;
+  for (i = 0; i < ENTRIES_PER_SECTOR; i++)
+    if (!ds->entries[i].in_use)
       {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
+        *ofsp = entry_ofs (sector_idx, i);
         return true;
       }
   return false;
 }
 
+/* Redistributes the entries in DIR into BUCKET_CNT hash buckets,
+   doubling BUCKET_CNT as many times as needed so that there are
+   at least as many buckets as DIR has sectors and no bucket
+   overflows, and switches DIR to the hashed format.  DS is
+   scratch space.  Returns true if successful.
+
+   Every entry is read into memory and sorted into its bucket
+   before anything is written.  The buckets whose sectors held no
+   entries are written first, which allocates every sector that
+   the new format needs, and only then are the old sectors
+   overwritten.  If any write fails, the buckets written so far
+   are emptied and the old sectors rewritten so far are put back
+   as they were, so DIR keeps its old format and all of its
+   entries. */
+static bool
+rehash (struct dir *dir, unsigned bucket_cnt, struct dir_sector *ds)
+{
+  size_t old_cnt = dir_sector_cnt (dir);
+  struct dir_entry *entries = NULL;
+  struct dir_entry *sorted = NULL;
+  size_t *buckets = NULL;
+  size_t *start = NULL;
+  size_t *old_start;
+  uint8_t *slots = NULL;
+  size_t entry_cnt = 0;
+  size_t entry_cap = 0;
+  size_t new_end = 0, old_end = 0;
+  size_t i, b;
+  bool success = false;
+
+  /* ENTRIES[OLD_START[I]] through ENTRIES[OLD_START[I + 1] - 1]
+     come from old sector I, where SLOTS gives their positions. */
+  old_start = calloc (old_cnt + 1, sizeof *old_start);
+  if (old_start == NULL)
+    return false;
+
+  /* Gather every entry. */
+  for (i = 0; i < old_cnt; i++)
+    {
+      size_t j;
+
+      if (!read_dir_sector (dir, i, ds))
+        goto done;
+      for (j = 0; j < ENTRIES_PER_SECTOR; j++)
+        if (ds->entries[j].in_use)
+          {
+            if (entry_cnt == entry_cap)
+              {
+                size_t new_cap = entry_cap * 2 + ENTRIES_PER_SECTOR;
+                struct dir_entry *new_entries;
+                uint8_t *new_slots;
+
+                new_entries = realloc (entries, new_cap * sizeof *entries);
+                if (new_entries == NULL)
+                  goto done;
+                entries = new_entries;
+                new_slots = realloc (slots, new_cap * sizeof *slots);
+                if (new_slots == NULL)
+                  goto done;
+                slots = new_slots;
+                entry_cap = new_cap;
+              }
+            slots[entry_cnt] = j;
+            entries[entry_cnt++] = ds->entries[j];
+          }
+      old_start[i + 1] = entry_cnt;
+    }
+  if (entry_cnt > 0)
+    {
+      sorted = malloc (entry_cnt * sizeof *sorted);
+      buckets = malloc (entry_cnt * sizeof *buckets);
+      if (sorted == NULL || buckets == NULL)
+        goto done;
+    }
+
+  /* Find a number of buckets that no bucket overflows.  Every
+     old sector must also be a bucket, so that it is rewritten
+     below and START has an element for it.  START[B] counts the
+     entries in bucket B-1 for now. */
+  while (bucket_cnt < old_cnt)
+    bucket_cnt *= 2;
+  for (;;)
+    {
+      bool overflow = false;
+
+      if (bucket_cnt > MAX_BUCKETS)
+        goto done;
+      free (start);
+      start = calloc (bucket_cnt + 1, sizeof *start);
+      if (start == NULL)
+        goto done;
+      for (i = 0; i < entry_cnt; i++)
+        {
+          buckets[i] = name_to_bucket (entries[i].name, bucket_cnt);
+          if (++start[buckets[i] + 1] > ENTRIES_PER_SECTOR)
+            overflow = true;
+        }
+      if (!overflow)
+        break;
+      bucket_cnt *= 2;
+    }
+
+  /* Sort the entries by bucket, so that bucket B's entries are
+     SORTED[START[B]] through SORTED[START[B + 1] - 1]. */
+  for (b = 0; b < bucket_cnt; b++)
+    start[b + 1] += start[b];
+  for (i = 0; i < entry_cnt; i++)
+    sorted[start[buckets[i]]++] = entries[i];
+  for (b = bucket_cnt; b > 0; b--)
+    start[b] = start[b - 1];
+  start[0] = 0;
+
+  /* First fill the buckets whose sectors held no entries before,
+     which may need new sectors.  Then overwrite the old sectors,
+     which are allocated already. */
+  ASSERT (old_cnt <= bucket_cnt);
+  for (b = 0; b < bucket_cnt; b++)
+    if (start[b + 1] > start[b]
+        && (b >= old_cnt || old_start[b + 1] == old_start[b])
+        && !write_dir_sector (dir, b, sorted + start[b],
+                              start[b + 1] - start[b], ds))
+      {
+        new_end = b + 1;
+        goto undo;
+      }
+  new_end = bucket_cnt;
+  for (b = 0; b < old_cnt; b++)
+    if (old_start[b + 1] > old_start[b]
+        && !write_dir_sector (dir, b, sorted + start[b],
+                              start[b + 1] - start[b], ds))
+      {
+        old_end = b + 1;
+        goto undo;
+      }
+
+  inode_set_dir_buckets (dir->inode, bucket_cnt);
+  success = true;
+  goto done;
+
+ undo:
+  /* Empty the new buckets and put back the old sectors, up to and
+     including the one whose write failed.  Neither needs a new
+     sector. */
+  for (b = 0; b < new_end; b++)
+    if (start[b + 1] > start[b]
+        && (b >= old_cnt || old_start[b + 1] == old_start[b]))
+      write_dir_sector (dir, b, NULL, 0, ds);
+  for (b = 0; b < old_end; b++)
+    if (old_start[b + 1] > old_start[b])
+      {
+        memset (ds, 0, sizeof *ds);
+        for (i = old_start[b]; i < old_start[b + 1]; i++)
+          ds->entries[slots[i]] = entries[i];
+        inode_write_at (dir->inode, ds, sizeof *ds, b * BLOCK_SECTOR_SIZE);
+      }
+
+ done:
+  free (start);
+  free (buckets);
+  free (sorted);
+  free (slots);
+  free (entries);
+  free (old_start);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Answers from the directory entry cache when it can, so that
+   repeated lookups of a name do not read DIR at all.
+   A directory that has been removed contains no files, not even
+   "." and "..". */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector;
+  block_sector_t sector = 0;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  inode_lock_shared (dir->inode);
+  if (!inode_is_removed (dir->inode))
+    {
+      dir_sector = inode_get_inumber (dir->inode);
+      if (!dcache_lookup (dir_sector, name, &sector))
+        {
+          sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+          dcache_insert (dir_sector, name, sector);
+        }
+    }
 
+  /* Open the inode before unlocking DIR, so that the file cannot
+     be removed, and its sector reused, in between. */
+  *inode = sector != 0 ? inode_open (sector) : NULL;
+  inode_unlock_shared (dir->inode);
   return *inode != NULL;
 }
 
+/* Searches DIR's own sectors for a file with the given NAME,
+   bypassing the directory entry cache, so that the answer
+   reflects what is in DIR rather than what was cached about it.
+   If one exists, stores its inode sector in *SECTOR and returns
+   true; otherwise, returns false.  For checking the file
+   system. */
+bool
+dir_lookup_sector (const struct dir *dir, const char *name,
+                   block_sector_t *sector)
+{
+  struct dir_entry e;
+  bool found;
+
+  ASSERT (dir != NULL);
+  ASSERT (name != NULL);
+
+  inode_lock_shared (dir->inode);
+  found = lookup (dir, name, &e, NULL);
+  inode_unlock_shared (dir->inode);
+  if (found)
+    *sector = e.inode_sector;
+  return found;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if DIR has been
+   removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
+  struct dir_sector *ds = NULL;
+  unsigned bucket_cnt;
   off_t ofs;
   bool success = false;
 
@@ -152,46 +525,134 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  inode_lock (dir->inode);
+
+  /* Nothing may be added to a removed directory. */
+  if (inode_is_removed (dir->inode))
+    goto done;
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
+  ds = malloc (sizeof *ds);
+  if (ds == NULL)
+    goto done;
+
   /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+     A linear directory may use a free slot in any sector, or
+     grow by a sector, up to LINEAR_MAX_SECTORS.  Past that we
+     switch to the hashed format, where NAME's bucket must have a
+     free slot; if it is full, we rehash into more buckets. */
+  bucket_cnt = inode_dir_buckets (dir->inode);
+  if (bucket_cnt == 0)
+    {
+      size_t sector_cnt = dir_sector_cnt (dir);
+      size_t sector_idx;
+
+      for (sector_idx = 0; sector_idx < sector_cnt; sector_idx++)
+        if (find_free_entry (dir, sector_idx, ds, &ofs))
+          break;
+      if (sector_idx >= sector_cnt)
+        {
+          if (sector_cnt < LINEAR_MAX_SECTORS)
+            ofs = entry_ofs (sector_cnt, 0);
+          else if (rehash (dir, MIN_BUCKETS, ds))
+            bucket_cnt = inode_dir_buckets (dir->inode);
+          else
+            goto done;
+        }
+    }
+  while (bucket_cnt != 0
+         && !find_free_entry (dir, name_to_bucket (name, bucket_cnt),
+                              ds, &ofs))
+    {
+      if (!rehash (dir, bucket_cnt * 2, ds))
+        goto done;
+      bucket_cnt = inode_dir_buckets (dir->inode);
+    }
 
   /* Write slot. */
+  memset (&e, 0, sizeof e);
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
+  inode_unlock (dir->inode);
+  free (ds);
   return success;
 }
 
+/* Reads the next entry in DIR other than "." and ".." and stores
+   its name in NAME.  Returns true if successful, false if DIR
+   contains no more entries.  DIR's inode must be locked. */
+static bool
+next_entry (struct dir *dir, char name[NAME_MAX + 1])
+{
+  struct dir_entry e;
+
+  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+    {
+      /* Advance to the next entry, skipping the unused bytes at
+         the end of each sector. */
+      size_t idx = dir->pos % BLOCK_SECTOR_SIZE / sizeof e;
+      if (idx + 1 < ENTRIES_PER_SECTOR)
+        dir->pos += sizeof e;
+      else
+        dir->pos = ROUND_UP (dir->pos + 1, BLOCK_SECTOR_SIZE);
+
+      if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
+        {
+          strlcpy (name, e.name, NAME_MAX + 1);
+          return true;
+        } 
+    }
+  return false;
+}
+
+/* Returns true if the directory in INODE contains no entries
+   other than "." and "..".  INODE must be locked. */
+static bool
+dir_is_empty (struct inode *inode)
+{
+  struct dir dir;
+  char name[NAME_MAX + 1];
+
+  dir.inode = inode;
+  dir.pos = 0;
+  return !next_entry (&dir, name);
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs if there is no file with the given NAME, or if
+   NAME is a directory that is not empty or is the root
+   directory.  An empty directory may be removed even if it is
+   open or is some thread's working directory; see dir_lookup()
+   and dir_add() for how it behaves afterward. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  bool is_dir = false;
   bool success = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /* "." and ".." are never removed, and locking the directories
+     they name here would break the locking order. */
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    return false;
+
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -201,36 +662,45 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only empty directories other than the root may be removed.
+     Keep the directory locked until it is marked removed, so that
+     nothing can be added to it in between. */
+  is_dir = inode_is_dir (inode);
+  if (is_dir)
+    {
+      inode_lock (inode);
+      if (e.inode_sector == ROOT_DIR_SECTOR || !dir_is_empty (inode))
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, 0);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (is_dir)
+    inode_unlock (inode);
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Never returns "." or "..". */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  bool success;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
-    {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
-    }
-  return false;
+  inode_lock_shared (dir->inode);
+  success = next_entry (dir, name);
+  inode_unlock_shared (dir->inode);
+  return success;
 }
@@ -2,14 +2,21 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* The root directory, kept open so that path lookups never have
+   to re-read its inode. */
+static struct dir *root_dir;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -22,12 +29,18 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  journal_init (format);
+  dcache_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
   free_map_open ();
+
+  root_dir = dir_open_root ();
+  if (root_dir == NULL)
+    PANIC ("can't open root directory");
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,9 +48,108 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  dir_close (root_dir);
   free_map_close ();
+  journal_done ();
+}
+
+/* Prints file system statistics. */
+void
+filesys_print_stats (void) 
+{
+  dcache_print_stats ();
+  free_map_print_stats ();
+  journal_print_stats ();
 }
 
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX characters from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Resolves PATH to the directory that contains its last
+   component, which is copied into NAME, and returns that
+   directory, which the caller must close.  A path that begins
+   with "/" is absolute; any other path is relative to the
+   current thread's working directory, or to the root directory
+   if it has none.  Either way, resolution starts from a
+   directory that is already open, so that no lookup has to
+   re-read the root directory or walk down to the working
+   directory.  A path with no components other than slashes,
+   such as "/", yields NAME ".".
+   Returns a null pointer if PATH is empty, if a component is too
+   long, or if a component other than the last is not an
+   existing directory. */
+static struct dir *
+resolve_path (const char *path, char name[NAME_MAX + 1])
+{
+  struct dir *cwd = thread_current ()->cwd;
+  struct dir *dir;
+  char next[NAME_MAX + 1];
+  int result;
+
+  if (*path == '\0')
+    return NULL;
+
+  dir = dir_reopen (*path == '/' || cwd == NULL ? root_dir : cwd);
+  if (dir == NULL)
+    return NULL;
+
+  result = get_next_part (name, &path);
+  if (result == 0)
+    strlcpy (name, ".", NAME_MAX + 1);
+  while (result > 0)
+    {
+      struct inode *inode;
+
+      result = get_next_part (next, &path);
+      if (result <= 0)
+        break;
+
+      /* NAME is not the last component, so descend into it. */
+      dir_lookup (dir, name, &inode);
+      dir_close (dir);
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return NULL;
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+  if (result < 0)
+    {
+      dir_close (dir);
+      return NULL;
+    }
+  return dir;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -46,19 +158,72 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  char base[NAME_MAX + 1];
+  struct dir *dir;
+  bool success = false;
+
+  journal_begin ();
+  dir = resolve_path (name, base);
+
+  /* Place the new inode near its directory's. */
+  if (dir != NULL)
+    {
+      block_sector_t parent = inode_get_inumber (dir_get_inode (dir));
+      success = (free_map_allocate_near (1, parent, &inode_sector)
+                 && inode_create (inode_sector, initial_size, false)
+                 && dir_add (dir, base, inode_sector));
+    }
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  free_map_sync ();
+  journal_end ();
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name) 
+{
+  block_sector_t inode_sector = 0;
+  char base[NAME_MAX + 1];
+  struct dir *dir;
+  bool created = false;
+  bool success = false;
+
+  journal_begin ();
+  dir = resolve_path (name, base);
+  if (dir != NULL && free_map_allocate_group (&inode_sector))
+    {
+      block_sector_t parent = inode_get_inumber (dir_get_inode (dir));
+      created = dir_create (inode_sector, 0, parent);
+      success = created && dir_add (dir, base, inode_sector);
+    }
+  if (!success && inode_sector != 0) 
+    {
+      /* Once the directory exists, it owns a data sector as well
+         as INODE_SECTOR, so free them all by removing it. */
+      struct inode *inode = created ? inode_open (inode_sector) : NULL;
+      if (inode != NULL)
+        {
+          inode_remove (inode);
+          inode_close (inode);
+        }
+      else
+        free_map_release (inode_sector, 1);
+    }
+  dir_close (dir);
+  free_map_sync ();
+  journal_end ();
+
+  return success;
+}
+
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,38 +231,75 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, base);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, base, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if NAME is a directory
+   that is not empty, or if an internal memory allocation
+   fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char base[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = resolve_path (name, base);
+  success = (dir != NULL
+             && strcmp (base, ".") && strcmp (base, "..")
+             && dir_remove (dir, base));
   dir_close (dir); 
+  free_map_sync ();
+  journal_end ();
 
   return success;
 }
-
+
+/* Changes the current thread's working directory to NAME.
+   Returns true if successful, false on failure.
+   Fails if NAME is not an existing directory, or if an internal
+   memory allocation fails. */
+bool
+filesys_chdir (const char *name) 
+{
+  struct thread *t = thread_current ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, base);
+  struct inode *inode = NULL;
+  struct dir *cwd;
+
+  if (dir != NULL)
+    dir_lookup (dir, base, &inode);
+  dir_close (dir);
+
+  cwd = dir_open (inode);
+  if (cwd == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = cwd;
+  return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
+  journal_commit ();
   printf ("done.\n");
 }
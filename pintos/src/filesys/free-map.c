@@ -1,51 +1,369 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Protects FREE_MAP, DIRTY, HELD, RESERVED, their counts, and
+   the statistics.  Never held while calling into another
+   module, except for the bitmap library. */
+static struct lock free_map_lock;
+
+/* Changes to the free map are not written to disk as they are
+   made.  Instead, each sector of the free map file whose bits
+   have changed is marked in DIRTY, one bit per sector, and
+   free_map_sync() writes just those sectors.  The file system
+   calls it at the end of each operation that creates or removes
+   a file and when the last opener of a file closes it, so that
+   however many sectors an operation allocates, each sector of
+   the map is written at most once.  Syncing holds the journal's
+   commit lock (see journal_lock_commits()), so that it never
+   overlaps a commit. */
+static struct bitmap *dirty;
+
+/* Sectors released since the journal last committed.  They are
+   free in FREE_MAP, but may not be allocated again until the
+   transaction that released them commits: if the system crashed
+   before then, replaying the journal would bring back the file
+   that owned them, which must not share them with another.
+   Commits happen only between operations, so once the held
+   sectors make up half of the free ones, releasing more asks
+   the journal to commit as soon as it can, before allocations
+   start to fail for want of them.
+   Only the sectors whose bits in the free map file have been
+   brought up to date may be made available by a commit; see
+   free_map_unhold(). */
+static struct bitmap *held;
+static size_t held_cnt;                 /* Number of held sectors. */
+static size_t free_cnt;                 /* Number of free sectors,
+                                           including held ones. */
+
+/* Sectors reserved for the preallocation windows of open inodes
+   (see inode.c).  They are free in FREE_MAP, and so on disk,
+   until they are claimed one by one, so that the unused part of
+   a window is not lost if the system crashes, but they are not
+   allocated to anyone else meanwhile. */
+static struct bitmap *reserved;
+
+/* Statistics. */
+static unsigned long long alloc_cnt;    /* Sectors allocated. */
+static unsigned long long release_cnt;  /* Sectors released. */
+static unsigned long long write_cnt;    /* Free map sectors written. */
+
+/* Number of sectors in a block group.  See
+   free_map_allocate_group(). */
+#define GROUP_SECTORS 1024
+
+/* Number of free map bits in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Marks the free map file sectors that hold the bits for CNT
+   sectors starting at SECTOR as needing to be written. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR,
+                       journal_sector_cnt (block_size (fs_device)), true);
+
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                       BLOCK_SECTOR_SIZE));
+  held = bitmap_create (block_size (fs_device));
+  reserved = bitmap_create (block_size (fs_device));
+  if (dirty == NULL || held == NULL || reserved == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+}
+
+/* Returns the first of the first CNT consecutive sectors at or
+   after START that are free and neither held nor reserved, or
+   BITMAP_ERROR if there are none.  The free map lock must be
+   held. */
+static size_t
+scan (size_t start, size_t cnt)
+{
+  for (;;)
+    {
+      size_t sector = bitmap_scan (free_map, start, cnt, false);
+      size_t h, r;
+
+      if (sector == BITMAP_ERROR
+          || (!bitmap_any (held, sector, cnt)
+              && !bitmap_any (reserved, sector, cnt)))
+        return sector;
+
+      /* Skip past the first held or reserved sector in the
+         way. */
+      h = bitmap_scan (held, sector, 1, true);
+      r = bitmap_scan (reserved, sector, 1, true);
+      start = (h < r ? h : r) + 1;
+    }
+}
+
+/* Returns the first of the first CNT consecutive available
+   sectors at or after HINT, wrapping around to the start of the
+   disk if there are none, or BITMAP_ERROR if there are none at
+   all.  The free map lock must be held. */
+static size_t
+scan_near (size_t cnt, block_sector_t hint)
+{
+  size_t sector;
+
+  if (hint >= bitmap_size (free_map))
+    hint = 0;
+  sector = scan (hint, cnt);
+  if (sector == BITMAP_ERROR && hint != 0)
+    sector = scan (0, cnt);
+  return sector;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if all sectors were
-   available. */
+   available.  The change reaches disk at the next
+   free_map_sync(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the first CNT consecutive
+   free sectors at or after HINT, wrapping around to the start of
+   the disk if there are none, so that related data can be kept
+   close together. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t hint,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+  bool want_commit = false;
+
+  lock_acquire (&free_map_lock);
+  sector = scan_near (cnt, hint);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      mark_dirty (sector, cnt);
+      alloc_cnt += cnt;
+      free_cnt -= cnt;
+      *sectorp = sector;
     }
+  else
+    want_commit = held_cnt > 0;
+  lock_release (&free_map_lock);
+
+  if (want_commit)
+    journal_want_commit ();
+  return sector != BITMAP_ERROR;
+}
+
+/* Reserves CNT consecutive sectors at or after HINT, as
+   free_map_allocate_near() would allocate them, and stores the
+   first into *SECTORP.  The sectors stay free on disk until they
+   are claimed with free_map_claim(); those never claimed must be
+   given back with free_map_unreserve().  Returns true if
+   successful, false if there are not enough free sectors. */
+bool
+free_map_reserve (size_t cnt, block_sector_t hint,
+                  block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = scan_near (cnt, hint);
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      bitmap_set_multiple (reserved, sector, cnt, true);
+      *sectorp = sector;
+    }
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates SECTOR, which must have been reserved with
+   free_map_reserve().  The change reaches disk at the next
+   free_map_sync(). */
+void
+free_map_claim (block_sector_t sector)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_test (reserved, sector));
+  ASSERT (!bitmap_test (free_map, sector));
+  bitmap_reset (reserved, sector);
+  bitmap_mark (free_map, sector);
+  mark_dirty (sector, 1);
+  alloc_cnt++;
+  free_cnt--;
+  lock_release (&free_map_lock);
+}
+
+/* Gives back the CNT reserved sectors starting at SECTOR, which
+   were never claimed, so that they may be allocated again right
+   away. */
+void
+free_map_unreserve (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (reserved, sector, cnt));
+  bitmap_set_multiple (reserved, sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Allocates a sector for a new directory's inode and stores it
+   into *SECTORP.  The sector comes from the block group with the
+   most free sectors, so that directories, and the files created
+   near them, are spread across the disk instead of crowding its
+   start.  Returns true if successful, false if the disk is
+   full. */
+bool
+free_map_allocate_group (block_sector_t *sectorp)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t group_cnt = DIV_ROUND_UP (sector_cnt, GROUP_SECTORS);
+  size_t best_group = 0;
+  size_t best_free = 0;
+  size_t group;
+
+  lock_acquire (&free_map_lock);
+  for (group = 0; group < group_cnt; group++)
+    {
+      size_t start = group * GROUP_SECTORS;
+      size_t cnt = sector_cnt - start < GROUP_SECTORS
+                   ? sector_cnt - start : GROUP_SECTORS;
+      size_t free_cnt = bitmap_count (free_map, start, cnt, false);
+      if (free_cnt > best_free)
+        {
+          best_group = group;
+          best_free = free_cnt;
+        }
+    }
+  lock_release (&free_map_lock);
+  return free_map_allocate_near (1, best_group * GROUP_SECTORS, sectorp);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use once
+   the journal next commits.  The change reaches disk at the next
+   free_map_sync(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  bool want_commit;
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  bitmap_set_multiple (held, sector, cnt, true);
+  mark_dirty (sector, cnt);
+  release_cnt += cnt;
+  held_cnt += cnt;
+  free_cnt += cnt;
+  want_commit = held_cnt > free_cnt / 2;
+  lock_release (&free_map_lock);
+
+  if (want_commit)
+    journal_want_commit ();
+}
+
+/* Makes the sectors released so far available for allocation,
+   except for those whose bits changed after the free map was
+   last synced, since their release did not make it into the
+   transaction.  Called by the journal, with commits locked, once
+   it has committed a transaction. */
+void
+free_map_unhold (void)
+{
+  size_t idx;
+
+  lock_acquire (&free_map_lock);
+  for (idx = 0; idx < bitmap_size (dirty); idx++)
+    if (!bitmap_test (dirty, idx))
+      {
+        size_t start = idx * BITS_PER_SECTOR;
+        size_t cnt = bitmap_size (held) - start;
+        if (cnt > BITS_PER_SECTOR)
+          cnt = BITS_PER_SECTOR;
+        held_cnt -= bitmap_count (held, start, cnt, true);
+        bitmap_set_multiple (held, start, cnt, false);
+      }
+  lock_release (&free_map_lock);
+}
+
+/* Writes each sector of the free map that has changed since it
+   was last written to the free map file.  Returns true if
+   successful, false if a write fails, in which case the sectors
+   not yet written remain marked for the next call. */
+bool
+free_map_sync (void) 
+{
+  bool locked;
+  bool success = true;
+
+  if (free_map_file == NULL)
+    return true;
+  locked = journal_lock_commits ();
+
+  /* Writing a sector of the free map file for the first time
+     allocates it, which dirties the map again, and so can
+     another thread changing the map while we write, so keep
+     going until nothing is left.  A sector's dirty bit is
+     cleared before it is written, so a change made during the
+     write marks it again. */
+  for (;;)
+    {
+      size_t idx;
+
+      lock_acquire (&free_map_lock);
+      idx = bitmap_scan_and_flip (dirty, 0, 1, true);
+      lock_release (&free_map_lock);
+      if (idx == BITMAP_ERROR)
+        break;
+
+      if (!bitmap_write_part (free_map, free_map_file,
+                              idx * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        {
+          lock_acquire (&free_map_lock);
+          bitmap_mark (dirty, idx);
+          lock_release (&free_map_lock);
+          success = false;
+          break;
+        }
+      write_cnt++;
+    }
+  if (locked)
+    journal_unlock_commits ();
+  return success;
+}
+
+/* Returns true if SECTOR is marked as in use in the free map. */
+bool
+free_map_in_use (block_sector_t sector)
+{
+  return bitmap_test (free_map, sector);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,13 +375,20 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty, false);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
-  file_close (free_map_file);
+  struct file *file = free_map_file;
+
+  if (!free_map_sync ())
+    printf ("free map: write failed\n");
+  free_map_file = NULL;
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,13 +397,22 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  bitmap_set_all (dirty, true);
+  if (!free_map_sync ())
     PANIC ("can't write free map");
 }
+
+/* Prints free map statistics. */
+void
+free_map_print_stats (void) 
+{
+  printf ("Free map: %llu sectors allocated, %llu released, "
+          "%llu map sectors written\n", alloc_cnt, release_cnt, write_cnt);
+}
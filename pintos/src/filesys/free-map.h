@@ -12,6 +12,16 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (size_t, block_sector_t hint, block_sector_t *);
+bool free_map_allocate_group (block_sector_t *);
+bool free_map_reserve (size_t, block_sector_t hint, block_sector_t *);
+void free_map_claim (block_sector_t);
+void free_map_unreserve (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+bool free_map_sync (void);
+void free_map_unhold (void);
+bool free_map_in_use (block_sector_t);
+
+void free_map_print_stats (void);
 
 #endif /* filesys/free-map.h */
@@ -1,14 +1,23 @@
 #include "filesys/fsutil.h"
+#include <bitmap.h>
 #include <debug.h>
+#include <inttypes.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* List files in the root directory. */
@@ -66,6 +75,10 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Number of bytes copied between a file and the scratch device
+   at a time, as a single block device request. */
+#define COPY_SIZE PGSIZE
+
 /* Extracts a ustar-format tar archive from the scratch block
    device into the Pintos file system. */
 void
@@ -78,7 +91,7 @@ fsutil_extract (char **argv UNUSED)
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = malloc (COPY_SIZE);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -109,7 +122,12 @@ fsutil_extract (char **argv UNUSED)
           break;
         }
       else if (type == USTAR_DIRECTORY)
-        printf ("ignoring directory %s\n", file_name);
+        {
+          printf ("Putting directory '%s' into the file system...\n",
+                  file_name);
+          if (!filesys_mkdir (file_name))
+            PANIC ("%s: mkdir failed", file_name);
+        }
       else if (type == USTAR_REGULAR)
         {
           struct file *dst;
@@ -126,10 +144,11 @@ fsutil_extract (char **argv UNUSED)
           /* Do copy. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
+              int chunk_size = size > COPY_SIZE ? COPY_SIZE : size;
+              block_sector_t cnt = DIV_ROUND_UP (chunk_size,
+                                                 BLOCK_SECTOR_SIZE);
+              block_read_multiple (src, sector, cnt, data);
+              sector += cnt;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -176,7 +195,7 @@ fsutil_append (char **argv)
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
   /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
+  buffer = malloc (COPY_SIZE);
   if (buffer == NULL)
     PANIC ("couldn't allocate buffer");
 
@@ -199,24 +218,569 @@ fsutil_append (char **argv)
   /* Do copy. */
   while (size > 0) 
     {
-      int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-      if (sector >= block_size (dst))
+      int chunk_size = size > COPY_SIZE ? COPY_SIZE : size;
+      block_sector_t cnt = DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE);
+      if (sector + cnt > block_size (dst))
         PANIC ("%s: out of space on scratch device", file_name);
       if (file_read (src, buffer, chunk_size) != chunk_size)
         PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-      block_write (dst, sector++, buffer);
+      memset (buffer + chunk_size, 0, cnt * BLOCK_SECTOR_SIZE - chunk_size);
+      block_write_multiple (dst, sector, cnt, buffer);
+      sector += cnt;
       size -= chunk_size;
     }
 
   /* Write ustar end-of-archive marker, which is two consecutive
      sectors full of zeros.  Don't advance our position past
      them, though, in case we have more files to append. */
-  memset (buffer, 0, BLOCK_SECTOR_SIZE);
-  block_write (dst, sector, buffer);
-  block_write (dst, sector, buffer + 1);
+  memset (buffer, 0, 2 * BLOCK_SECTOR_SIZE);
+  block_write_multiple (dst, sector, 2, buffer);
 
   /* Finish up. */
   file_close (src);
   free (buffer);
 }
+
+/* State of a file system check. */
+struct fsck
+  {
+    struct bitmap *used;        /* Sectors found in use so far. */
+    int error_cnt;              /* Number of problems found. */
+
+    /* The inode being checked. */
+    block_sector_t inode;       /* Its sector. */
+    size_t data_cnt;            /* Number of data sectors. */
+    size_t extent_cnt;          /* Number of runs of data sectors. */
+    block_sector_t last_data;   /* Last data sector. */
+
+    /* Totals. */
+    size_t file_cnt;            /* Ordinary files. */
+    size_t dir_cnt;             /* Directories. */
+    size_t total_data_cnt;      /* Data sectors. */
+    size_t index_cnt;           /* Index blocks. */
+    size_t total_extent_cnt;    /* Extents in files with data. */
+    size_t max_extent_cnt;      /* Most extents in one file. */
+    size_t fragmented_cnt;      /* Files with more than one extent. */
+  };
+
+/* Marks SECTOR as in use by the inode that FSCK is checking.
+   Reports a problem and returns false if SECTOR is not on the
+   file system device or is already in use. */
+static bool
+fsck_claim (struct fsck *fsck, block_sector_t sector)
+{
+  if (sector >= bitmap_size (fsck->used))
+    {
+      printf ("fsck: inode %"PRDSNu": sector %"PRDSNu" is past end "
+              "of device\n", fsck->inode, sector);
+      fsck->error_cnt++;
+      return false;
+    }
+  if (bitmap_test (fsck->used, sector))
+    {
+      printf ("fsck: inode %"PRDSNu": sector %"PRDSNu" is already "
+              "in use\n", fsck->inode, sector);
+      fsck->error_cnt++;
+      return false;
+    }
+  bitmap_mark (fsck->used, sector);
+  return true;
+}
+
+/* Called by inode_walk() for each sector of the inode being
+   checked. */
+static void
+fsck_sector (block_sector_t sector, bool is_data, void *fsck_)
+{
+  struct fsck *fsck = fsck_;
+
+  fsck_claim (fsck, sector);
+  if (is_data)
+    {
+      if (fsck->data_cnt == 0 || sector != fsck->last_data + 1)
+        fsck->extent_cnt++;
+      fsck->last_data = sector;
+      fsck->data_cnt++;
+    }
+  else
+    fsck->index_cnt++;
+}
+
+/* Checks INODE, which is in SECTOR, and every sector it owns.
+   Returns false if INODE is not valid. */
+static bool
+fsck_inode (struct fsck *fsck, struct inode *inode, block_sector_t sector)
+{
+  fsck->inode = sector;
+  fsck->data_cnt = fsck->extent_cnt = 0;
+  if (!fsck_claim (fsck, sector))
+    return false;
+  if (!inode_walk (inode, fsck_sector, fsck))
+    {
+      printf ("fsck: inode %"PRDSNu": bad inode\n", sector);
+      fsck->error_cnt++;
+      return false;
+    }
+
+  if (inode_is_dir (inode))
+    fsck->dir_cnt++;
+  else
+    fsck->file_cnt++;
+  fsck->total_data_cnt += fsck->data_cnt;
+  fsck->total_extent_cnt += fsck->extent_cnt;
+  if (fsck->extent_cnt > fsck->max_extent_cnt)
+    fsck->max_extent_cnt = fsck->extent_cnt;
+  if (fsck->extent_cnt > 1)
+    fsck->fragmented_cnt++;
+  return true;
+}
+
+/* Checks that NAME in directory DIR, whose inode is in sector
+   DIR_SECTOR, refers to the inode in sector EXPECTED.  Reads
+   DIR's sectors, not the directory entry cache, so that what is
+   checked is what is on disk. */
+static void
+fsck_link (struct fsck *fsck, struct dir *dir, block_sector_t dir_sector,
+           const char *name, block_sector_t expected)
+{
+  block_sector_t sector;
+
+  if (!dir_lookup_sector (dir, name, &sector))
+    {
+      printf ("fsck: directory %"PRDSNu": no \"%s\" entry\n",
+              dir_sector, name);
+      fsck->error_cnt++;
+    }
+  else if (sector != expected)
+    {
+      printf ("fsck: directory %"PRDSNu": \"%s\" is %"PRDSNu", "
+              "should be %"PRDSNu"\n",
+              dir_sector, name, sector, expected);
+      fsck->error_cnt++;
+    }
+}
+
+/* Walks the directory tree from the root, checking each
+   directory and file in it. */
+static void
+fsck_tree (struct fsck *fsck)
+{
+  /* Directories still to visit, as pairs of (directory sector,
+     parent directory sector). */
+  block_sector_t *stack = NULL;
+  size_t stack_cnt = 0;
+  size_t stack_cap = 0;
+  struct inode *root;
+
+  root = inode_open (ROOT_DIR_SECTOR);
+  if (root == NULL || !inode_is_dir (root))
+    {
+      printf ("fsck: root directory is missing\n");
+      fsck->error_cnt++;
+      inode_close (root);
+      return;
+    }
+  if (!fsck_inode (fsck, root, ROOT_DIR_SECTOR))
+    {
+      inode_close (root);
+      return;
+    }
+  inode_close (root);
+
+  stack_cap = 16;
+  stack = malloc (stack_cap * 2 * sizeof *stack);
+  if (stack == NULL)
+    PANIC ("couldn't allocate directory stack");
+  stack[0] = stack[1] = ROOT_DIR_SECTOR;
+  stack_cnt = 1;
+
+  while (stack_cnt > 0)
+    {
+      block_sector_t sector, parent;
+      char name[NAME_MAX + 1];
+      struct dir *dir;
+
+      stack_cnt--;
+      sector = stack[stack_cnt * 2];
+      parent = stack[stack_cnt * 2 + 1];
+      dir = dir_open (inode_open (sector));
+      if (dir == NULL)
+        PANIC ("couldn't open directory %"PRDSNu, sector);
+
+      fsck_link (fsck, dir, sector, ".", sector);
+      fsck_link (fsck, dir, sector, "..", parent);
+      while (dir_readdir (dir, name))
+        {
+          struct inode *inode;
+          block_sector_t child;
+
+          if (!dir_lookup_sector (dir, name, &child))
+            continue;
+          inode = inode_open (child);
+          if (inode == NULL)
+            PANIC ("couldn't open inode %"PRDSNu, child);
+          if (fsck_inode (fsck, inode, child) && inode_is_dir (inode))
+            {
+              if (stack_cnt == stack_cap)
+                {
+                  block_sector_t *new_stack;
+
+                  stack_cap *= 2;
+                  new_stack = realloc (stack,
+                                       stack_cap * 2 * sizeof *stack);
+                  if (new_stack == NULL)
+                    PANIC ("couldn't allocate directory stack");
+                  stack = new_stack;
+                }
+              stack[stack_cnt * 2] = child;
+              stack[stack_cnt * 2 + 1] = sector;
+              stack_cnt++;
+            }
+          inode_close (inode);
+        }
+      dir_close (dir);
+    }
+  free (stack);
+}
+
+/* Checks the file system: walks every directory and file
+   reachable from the root, checking that no sector is used
+   twice and that the free map agrees with what is in use, and
+   then reports how fragmented the files and free space are. */
+void
+fsutil_fsck (char **argv UNUSED) 
+{
+  block_sector_t fs_size = block_size (fs_device);
+  block_sector_t sector;
+  size_t free_cnt = 0, leaked_cnt = 0;
+  size_t run_hist[32];
+  size_t run = 0, max_run = 0;
+  struct fsck fsck;
+  struct inode *inode;
+  int i;
+
+  printf ("Checking file system...\n");
+  memset (&fsck, 0, sizeof fsck);
+  fsck.used = bitmap_create (fs_size);
+  if (fsck.used == NULL)
+    PANIC ("couldn't allocate bitmap");
+
+  /* The free map file and the journal. */
+  inode = inode_open (FREE_MAP_SECTOR);
+  if (inode == NULL || !fsck_inode (&fsck, inode, FREE_MAP_SECTOR))
+    PANIC ("free map inode is corrupt");
+  inode_close (inode);
+  bitmap_set_multiple (fsck.used, JOURNAL_SECTOR,
+                       journal_sector_cnt (fs_size), true);
+
+  fsck_tree (&fsck);
+
+  /* Cross-check with the free map, and measure free space
+     fragmentation: RUN_HIST[I] counts runs of 2**I through
+     2**(I + 1) - 1 free sectors. */
+  memset (run_hist, 0, sizeof run_hist);
+  for (sector = 0; sector <= fs_size; sector++)
+    {
+      bool in_map = sector < fs_size && free_map_in_use (sector);
+      bool used = sector < fs_size && bitmap_test (fsck.used, sector);
+
+      if (used && !in_map)
+        {
+          printf ("fsck: sector %"PRDSNu" is in use but marked free\n",
+                  sector);
+          fsck.error_cnt++;
+        }
+      else if (!used && in_map)
+        leaked_cnt++;
+
+      if (sector < fs_size && !in_map)
+        {
+          free_cnt++;
+          run++;
+        }
+      else if (run > 0)
+        {
+          size_t bucket = 0;
+          while ((run >> (bucket + 1)) != 0)
+            bucket++;
+          run_hist[bucket]++;
+          if (run > max_run)
+            max_run = run;
+          run = 0;
+        }
+    }
+  if (leaked_cnt > 0)
+    {
+      printf ("fsck: %zu sectors are marked in use but unreachable\n",
+              leaked_cnt);
+      fsck.error_cnt++;
+    }
+
+  printf ("fsck: %zu directories, %zu files, %zu data sectors, "
+          "%zu index blocks\n", fsck.dir_cnt, fsck.file_cnt,
+          fsck.total_data_cnt, fsck.index_cnt);
+  printf ("fsck: %zu extents, at most %zu in one file, "
+          "%zu files in more than one extent\n",
+          fsck.total_extent_cnt, fsck.max_extent_cnt, fsck.fragmented_cnt);
+  printf ("fsck: %zu of %"PRDSNu" sectors free, largest free run "
+          "%zu sectors\n", free_cnt, fs_size, max_run);
+  for (i = 0; i < 32; i++)
+    if (run_hist[i] > 0)
+      printf ("fsck: %zu free runs of %zu to %zu sectors\n",
+              run_hist[i], (size_t) 1 << i, ((size_t) 2 << i) - 1);
+  if (fsck.error_cnt == 0)
+    printf ("fsck: file system is clean\n");
+  else
+    printf ("fsck: %d problems found\n", fsck.error_cnt);
+
+  bitmap_destroy (fsck.used);
+}
+
+/* Largest transfer measured by fsutil_bench(), in sectors. */
+#define BENCH_MAX_SECTORS 128
+
+/* Most transfers that fsutil_bench() keeps in flight at once. */
+#define BENCH_DEPTH 4
+
+/* Times sequential transfers of CNT sectors each across the first
+   SIZE sectors of DEV, reading into BUFFER or, if WRITE, writing
+   from it, with up to DEPTH transfers in flight at once.  Repeats
+   full passes until at least a second has elapsed, then prints
+   the throughput in MB/s, and the share of the time the CPU was
+   not idle, labeled with NAME. */
+static void
+bench_transfers (struct block *dev, block_sector_t size,
+                 block_sector_t cnt, uint8_t *buffer, bool write,
+                 size_t depth, const char *name)
+{
+  struct block_request reqs[BENCH_DEPTH];
+  uint64_t bytes = 0;
+  int64_t start = timer_ticks ();
+  int64_t idle_start = thread_idle_ticks ();
+  int64_t elapsed, busy;
+  uint64_t rate;
+
+  do
+    {
+      block_sector_t sector;
+      size_t next = 0, in_flight = 0;
+
+      /* REQS is a ring in which NEXT is the oldest request once
+         DEPTH of them are in flight.  Transfers in flight share
+         BUFFER, which is harmless here. */
+      for (sector = 0; sector + cnt <= size; sector += cnt)
+        {
+          struct block_request *r = &reqs[next];
+
+          if (in_flight == depth)
+            {
+              block_wait (r);
+              in_flight--;
+            }
+          r->write = write;
+          r->sector = sector;
+          r->cnt = cnt;
+          r->buffer = buffer;
+          r->complete = NULL;
+          block_submit (dev, r);
+          in_flight++;
+          next = (next + 1) % depth;
+        }
+      for (; in_flight > 0; in_flight--)
+        block_wait (&reqs[(next + depth - in_flight) % depth]);
+      bytes += (uint64_t) (size / cnt) * cnt * BLOCK_SECTOR_SIZE;
+      elapsed = timer_elapsed (start);
+    }
+  while (elapsed < TIMER_FREQ);
+  busy = elapsed - (thread_idle_ticks () - idle_start);
+
+  /* Hundredths of a MB/s. */
+  rate = bytes * TIMER_FREQ * 100 / elapsed / (1024 * 1024);
+  printf ("bench: %"PRDSNu" KiB %s, %zu in flight: %"PRIu64".%02"PRIu64
+          " MB/s, CPU %"PRId64"%% busy\n", cnt * BLOCK_SECTOR_SIZE / 1024,
+          name, depth, rate / 100, rate % 100, busy * 100 / elapsed);
+}
+
+/* Measures the throughput of 4 KiB and 64 KiB sequential reads
+   and writes on the scratch device, and how busy they keep the
+   CPU, overwriting the device's contents.  Also measures 64 KiB
+   transfers with several in flight, which a striped device can
+   spread across its members. */
+void
+fsutil_bench (char **argv UNUSED) 
+{
+  static const block_sector_t sizes[] = {8, BENCH_MAX_SECTORS};
+  struct block *dev;
+  block_sector_t size;
+  uint8_t *buffer;
+  size_t i;
+
+  dev = block_get_role (BLOCK_SCRATCH);
+  if (dev == NULL)
+    PANIC ("couldn't open scratch device");
+  size = block_size (dev);
+  if (size > 2048)
+    size = 2048;
+  if (size < BENCH_MAX_SECTORS)
+    PANIC ("scratch device must have at least %d sectors",
+           BENCH_MAX_SECTORS);
+
+  buffer = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                                DIV_ROUND_UP (BENCH_MAX_SECTORS
+                                              * BLOCK_SECTOR_SIZE,
+                                              PGSIZE));
+  printf ("bench: measuring %"PRDSNu" sectors of scratch device %s\n",
+          size, block_name (dev));
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      bench_transfers (dev, size, sizes[i], buffer, false, 1, "reads");
+      bench_transfers (dev, size, sizes[i], buffer, true, 1, "writes");
+    }
+  bench_transfers (dev, size, BENCH_MAX_SECTORS, buffer, false,
+                   BENCH_DEPTH, "reads");
+  bench_transfers (dev, size, BENCH_MAX_SECTORS, buffer, true,
+                   BENCH_DEPTH, "writes");
+  palloc_free_multiple (buffer, DIV_ROUND_UP (BENCH_MAX_SECTORS
+                                              * BLOCK_SECTOR_SIZE,
+                                              PGSIZE));
+}
+
+/* Threads, and 4 kB reads per thread, in fsutil_iobench(). */
+#define IOBENCH_THREADS 4
+#define IOBENCH_READS 256
+
+/* State shared by fsutil_iobench() and its reader threads. */
+struct iobench
+  {
+    struct block *dev;          /* Device being read. */
+    block_sector_t region;      /* Sectors in each thread's region. */
+    uint64_t *latency;          /* Each read's latency, in TSC cycles. */
+    struct semaphore done;      /* Up'd as each thread finishes. */
+  };
+
+/* One reader thread's part of fsutil_iobench(). */
+struct iobench_reader
+  {
+    struct iobench *bench;      /* Shared state. */
+    int idx;                    /* Thread number. */
+  };
+
+/* Compares the uint64_t values that A and B point to, for
+   qsort(). */
+static int
+compare_u64 (const void *a_, const void *b_)
+{
+  const uint64_t *a = a_;
+  const uint64_t *b = b_;
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Reads its own region of the device 4 kB at a time, in order,
+   timing each read.  READER_ is a struct iobench_reader. */
+static void
+iobench_reader (void *reader_)
+{
+  struct iobench_reader *reader = reader_;
+  struct iobench *bench = reader->bench;
+  block_sector_t start = reader->idx * bench->region;
+  uint64_t *latency = bench->latency + reader->idx * IOBENCH_READS;
+  void *buffer = palloc_get_page (PAL_ASSERT);
+  int i;
+
+  for (i = 0; i < IOBENCH_READS; i++)
+    {
+      uint64_t cycles = timer_cycles ();
+      block_read_multiple (bench->dev, start + (i * 8) % bench->region, 8,
+                           buffer);
+      latency[i] = timer_cycles () - cycles;
+    }
+  palloc_free_page (buffer);
+  sema_up (&bench->done);
+}
+
+/* Makes every block device with a request queue use the
+   scheduler named NAME. */
+static void
+set_schedulers (const char *name)
+{
+  struct block *dev;
+
+  for (dev = block_first (); dev != NULL; dev = block_next (dev))
+    block_set_scheduler (dev, name);
+}
+
+/* Measures each I/O scheduler with several threads reading
+   separate regions of the scratch device at once, which makes a
+   disk seek back and forth between them.  Prints the throughput
+   and the median, 99th percentile, and worst read latencies. */
+void
+fsutil_iobench (char **argv UNUSED) 
+{
+  static const char *policies[] = {"noop", "clook", "deadline"};
+  const size_t lat_cnt = IOBENCH_THREADS * IOBENCH_READS;
+  struct iobench_reader readers[IOBENCH_THREADS];
+  struct iobench bench;
+  const char *old_policy = "deadline";
+  struct block *dev;
+  size_t i;
+
+  bench.dev = block_get_role (BLOCK_SCRATCH);
+  if (bench.dev == NULL)
+    PANIC ("couldn't open scratch device");
+  bench.region = block_size (bench.dev) / IOBENCH_THREADS / 8 * 8;
+  if (bench.region == 0)
+    PANIC ("scratch device must have at least %d sectors",
+           IOBENCH_THREADS * 8);
+  bench.latency = malloc (lat_cnt * sizeof *bench.latency);
+  if (bench.latency == NULL)
+    PANIC ("couldn't allocate latency array");
+  sema_init (&bench.done, 0);
+
+  /* The scratch device is usually a partition, which has no queue
+     of its own, so switch every device's scheduler. */
+  for (dev = block_first (); dev != NULL; dev = block_next (dev))
+    if (strcmp (block_scheduler_name (dev), "none"))
+      {
+        old_policy = block_scheduler_name (dev);
+        break;
+      }
+
+  for (i = 0; i < sizeof policies / sizeof *policies; i++)
+    {
+      uint64_t rate;
+      int64_t start, elapsed;
+      int t;
+
+      set_schedulers (policies[i]);
+      start = timer_ticks ();
+      for (t = 0; t < IOBENCH_THREADS; t++)
+        {
+          char name[16];
+
+          readers[t].bench = &bench;
+          readers[t].idx = t;
+          snprintf (name, sizeof name, "iobench%d", t);
+          thread_create (name, PRI_DEFAULT, iobench_reader, &readers[t]);
+        }
+      for (t = 0; t < IOBENCH_THREADS; t++)
+        sema_down (&bench.done);
+      elapsed = timer_elapsed (start);
+      if (elapsed == 0)
+        elapsed = 1;
+
+      qsort (bench.latency, lat_cnt, sizeof *bench.latency, compare_u64);
+
+      /* Hundredths of a MB/s. */
+      rate = ((uint64_t) lat_cnt * 8 * BLOCK_SECTOR_SIZE * TIMER_FREQ * 100
+              / elapsed / (1024 * 1024));
+      printf ("iobench: %s: %"PRIu64".%02"PRIu64" MB/s, latency "
+              "p50 %"PRIu64" us, p99 %"PRIu64" us, max %"PRIu64" us\n",
+              policies[i], rate / 100, rate % 100,
+              timer_cycles_to_us (bench.latency[lat_cnt / 2]),
+              timer_cycles_to_us (bench.latency[lat_cnt * 99 / 100]),
+              timer_cycles_to_us (bench.latency[lat_cnt - 1]));
+    }
+
+  set_schedulers (old_policy);
+  free (bench.latency);
+}
@@ -1,79 +1,372 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of sector pointers in an on-disk inode and in an
+   indirect block. */
+#define DIRECT_CNT 120
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Largest number of data sectors a single inode can address:
+   direct blocks, one indirect block, and one doubly indirect
+   block. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A sector pointer of 0 means "not allocated".  Sector 0 holds
+   the free map inode, so it can never be file data.  Reading an
+   unallocated data sector yields zeros without touching the
+   disk, which lets files be sparse. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t dir_buckets;               /* Directory hash buckets, or 0. */
+    uint32_t is_dir;                    /* 1 for a directory, 0 for a file. */
+    uint32_t unused[2];                 /* Not used. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* In-memory inode.
 
-/* In-memory inode. */
+   DATA_LOCK protects DATA, DENY_WRITE_CNT, and the inode's
+   contents on disk: inode_read_at() holds it for reading, so
+   that any number of threads can read the same file at once,
+   and inode_write_at() holds it for writing.  LOCK is not used
+   by this file at all; it lets the inode's users, such as
+   directories, make compound changes atomically.  A thread that
+   needs both must acquire LOCK first. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    block_sector_t prealloc_start;      /* First preallocated sector. */
+    size_t prealloc_cnt;                /* Number of preallocated sectors. */
+    struct rwlock lock;                 /* For the inode's users. */
+    struct rwlock data_lock;            /* Protects the data, see above. */
     struct inode_disk data;             /* Inode content. */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* A growing file takes new sectors from a window of up to
+   PREALLOC_SECTORS consecutive sectors that it reserves in the
+   free map, so that the data of files that grow at the same time
+   is not interleaved sector by sector.  Each window is placed as
+   close as possible after the previous one, which starts out just
+   after the inode itself.  The reservation is kept in memory
+   only: a sector is allocated on disk when the file takes it, so
+   a crash leaks none of the rest.  Sectors left over in the
+   window are given back when the inode is last closed, or when
+   the disk fills up.  The windows of open inodes are protected
+   by open_inodes_lock, below. */
+#define PREALLOC_SECTORS 8
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock
+   protects the table and every inode's open_cnt and
+   preallocation window. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/* Gives back the unused sectors in INODE's preallocation window.
+   INODE must not be in the open inode table, or open_inodes_lock
+   must be held. */
+static void
+release_window (struct inode *inode)
+{
+  if (inode->prealloc_cnt > 0)
+    {
+      free_map_unreserve (inode->prealloc_start, inode->prealloc_cnt);
+      inode->prealloc_cnt = 0;
+    }
+}
+
+/* Allocates a data or index sector for INODE from its
+   preallocation window, reserving a new window if it is empty,
+   and stores it in *SECTORP.  Returns true if successful, false
+   if the disk is full.  INODE's data lock must be held for
+   writing, so that no other thread can refill the window at the
+   same time. */
+static bool
+allocate_sector (struct inode *inode, block_sector_t *sectorp)
+{
+  block_sector_t hint, start;
+  size_t cnt;
+
+  lock_acquire (&open_inodes_lock);
+  if (inode->prealloc_cnt > 0)
+    {
+      *sectorp = inode->prealloc_start++;
+      inode->prealloc_cnt--;
+      free_map_claim (*sectorp);
+      lock_release (&open_inodes_lock);
+      return true;
+    }
+  hint = inode->prealloc_start;
+  lock_release (&open_inodes_lock);
+
+  if (free_map_reserve (PREALLOC_SECTORS, hint, &start))
+    {
+      free_map_claim (start);
+      cnt = PREALLOC_SECTORS;
+    }
+  else
+    {
+      /* Take a single sector, even if that means giving up the
+         other files' windows to find one. */
+      if (!free_map_allocate_near (1, hint, &start))
+        {
+          inode_release_windows ();
+          if (!free_map_allocate_near (1, hint, &start))
+            return false;
+        }
+      cnt = 1;
+    }
+
+  lock_acquire (&open_inodes_lock);
+  ASSERT (inode->prealloc_cnt == 0);
+  *sectorp = start;
+  inode->prealloc_start = start + 1;
+  inode->prealloc_cnt = cnt - 1;
+  lock_release (&open_inodes_lock);
+  return true;
+}
+
+/* Follows the index tree of INODE rooted at *SLOTP down LEVEL
+   levels to the data sector for relative block IDX, and returns
+   it.  LEVEL 0 means that *SLOTP is the data sector itself.
+
+   Returns 0 if the data sector is not allocated.  If ALLOCATE is
+   true, missing index and data sectors are allocated along the
+   way, and *FRESH is set to true if the data sector itself is
+   new (its contents are garbage); 0 is then returned only if the
+   disk is full.  Updates *SLOTP if it is allocated here; the
+   caller must write that change back. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+index_lookup (struct inode *inode, block_sector_t *slotp, int level,
+              size_t idx, bool allocate, bool *fresh)
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  block_sector_t *index = NULL;
+  block_sector_t sector;
+  size_t span, child;
+  bool dirty = false;
+
+  /* Get a buffer for the index block before allocating it, so
+     that *SLOTP never points to an index block that was not
+     zeroed. */
+  if (level > 0)
+    {
+      index = malloc (BLOCK_SECTOR_SIZE);
+      if (index == NULL)
+        return 0;
+    }
+
+  if (*slotp == 0)
+    {
+      if (!allocate || !allocate_sector (inode, slotp))
+        {
+          free (index);
+          return 0;
+        }
+      if (level == 0)
+        *fresh = true;
+      dirty = true;
+    }
+  if (level == 0)
+    return *slotp;
+
+  if (dirty)
+    memset (index, 0, BLOCK_SECTOR_SIZE);
   else
-    return -1;
+    journal_read (*slotp, index);
+
+  span = level == 1 ? 1 : PTRS_PER_SECTOR;
+  child = idx / span;
+  sector = index[child];
+  if (sector == 0 && allocate)
+    {
+      sector = index_lookup (inode, &index[child], level - 1, idx % span,
+                             allocate, fresh);
+      dirty = true;
+    }
+  else if (sector != 0 && level > 1)
+    sector = index_lookup (inode, &index[child], level - 1, idx % span,
+                           allocate, fresh);
+
+  if (dirty)
+    journal_write_metadata (*slotp, index);
+  free (index);
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the data sector for block IDX of INODE, or 0 if it is
+   not allocated.  With ALLOCATE, allocates the sector if needed
+   (see index_lookup()) and writes INODE's on-disk header back if
+   that changed one of its pointers. */
+static block_sector_t
+block_to_sector (struct inode *inode, size_t idx, bool allocate, bool *fresh)
+{
+  struct inode_disk *d = &inode->data;
+  block_sector_t *slotp;
+  block_sector_t old, sector;
+  int level;
+
+  if (idx < DIRECT_CNT)
+    {
+      slotp = &d->direct[idx];
+      level = 0;
+    }
+  else if ((idx -= DIRECT_CNT) < PTRS_PER_SECTOR)
+    {
+      slotp = &d->indirect;
+      level = 1;
+    }
+  else if ((idx -= PTRS_PER_SECTOR) < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      slotp = &d->doubly_indirect;
+      level = 2;
+    }
+  else
+    return 0;
+
+  old = *slotp;
+  sector = index_lookup (inode, slotp, level, idx, allocate, fresh);
+  if (*slotp != old)
+    journal_write_metadata (inode->sector, d);
+  return sector;
+}
+
+/* Releases the sector at SECTOR and, if it is an index block
+   LEVEL levels above the data, every sector it points to. */
+static void
+release_tree (block_sector_t sector, int level)
+{
+  if (sector == 0)
+    return;
+  if (level > 0)
+    {
+      block_sector_t *index = malloc (BLOCK_SECTOR_SIZE);
+      size_t i;
+
+      if (index == NULL)
+        PANIC ("out of memory releasing inode blocks");
+      journal_read (sector, index);
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        release_tree (index[i], level - 1);
+      free (index);
+    }
+  free_map_release (sector, 1);
+}
+
+/* Releases every data and index sector owned by DISK_INODE. */
+static void
+release_sectors (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_tree (disk_inode->direct[i], 0);
+  release_tree (disk_inode->indirect, 1);
+  release_tree (disk_inode->doubly_indirect, 2);
+}
+
+/* Calls FUNC on the sector at SECTOR, with IS_DATA true if LEVEL
+   is 0, and then, if it is an index block LEVEL levels above the
+   data, on every sector it points to, in order.  Does not follow
+   pointers to sectors that are not on the file system device. */
+static void
+walk_tree (block_sector_t sector, int level, inode_walk_func *func,
+           void *aux)
+{
+  if (sector == 0)
+    return;
+  func (sector, level == 0, aux);
+  if (level > 0 && sector < block_size (fs_device))
+    {
+      block_sector_t *index = malloc (BLOCK_SECTOR_SIZE);
+      size_t i;
+
+      if (index == NULL)
+        PANIC ("out of memory walking inode blocks");
+      journal_read (sector, index);
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        walk_tree (index[i], level - 1, func, aux);
+      free (index);
+    }
+}
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Gives back the preallocation windows of all open inodes. */
+void
+inode_release_windows (void)
+{
+  struct hash_iterator i;
+
+  lock_acquire (&open_inodes_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    release_window (hash_entry (hash_cur (&i), struct inode, elem));
+  lock_release (&open_inodes_lock);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate open inode table");
+  lock_init (&open_inodes_lock);
+}
+
+/* Returns a hash value for the inode that contains E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is a directory if IS_DIR is true, an
+   ordinary file otherwise.  No data sectors are allocated: the
+   file starts out as one big hole that reads back as zeros, and
+   sectors are allocated as they are first written.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
 
   ASSERT (length >= 0);
 
@@ -81,28 +374,19 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if ((size_t) DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE) > MAX_SECTORS)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
-  return success;
+  if (disk_inode == NULL)
+    return false;
+
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  journal_write_metadata (sector, disk_inode);
+  free (disk_inode);
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -111,33 +395,45 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The sector is read with the table locked, so
+     that a concurrent opener of the same sector cannot see a
+     half-initialized inode. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->prealloc_start = sector + 1;
+  inode->prealloc_cnt = 0;
+  rwlock_init (&inode->lock);
+  rwlock_init (&inode->data_lock);
+  journal_read (inode->sector, &inode->data);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +442,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -168,21 +468,33 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from inode table and release lock. */
+      hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
  
-      /* Deallocate blocks if removed. */
+      journal_begin ();
+
+      /* Give back the unused part of the preallocation window,
+         and deallocate blocks if removed. */
+      release_window (inode);
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_sectors (&inode->data);
         }
 
+      /* Record the sectors allocated by writes to INODE, or
+         released just above. */
+      free_map_sync ();
+      journal_end ();
+
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -194,20 +506,76 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Acquires INODE's lock for reading.  The inode itself does not
+   use this lock, so its meaning is up to the callers: directories
+   hold it for reading while they look up names and for writing
+   while they change entries. */
+void
+inode_lock_shared (struct inode *inode)
+{
+  rwlock_acquire_read (&inode->lock);
+}
+
+/* Releases INODE's lock, held for reading. */
+void
+inode_unlock_shared (struct inode *inode)
+{
+  rwlock_release_read (&inode->lock);
+}
+
+/* Acquires INODE's lock for writing. */
+void
+inode_lock (struct inode *inode)
+{
+  rwlock_acquire_write (&inode->lock);
+}
+
+/* Releases INODE's lock, held for writing. */
+void
+inode_unlock (struct inode *inode)
+{
+  rwlock_release_write (&inode->lock);
+}
+
+/* Number of full sectors that inode_read_at() and
+   inode_write_at() gather into one transfer. */
+#define IOV_CNT 16
+
+/* Returns the running thread's buffer for sectors that are read
+   or written only in part, allocating it if necessary, or a null
+   pointer if memory is short.  The buffer is in use only from
+   the time it is filled until it is handed to the journal, and
+   nothing in between can start another transfer in the same
+   thread, so a single buffer per thread is enough. */
+static uint8_t *
+edge_buffer (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->fs_edge == NULL)
+    t->fs_edge = malloc (BLOCK_SECTOR_SIZE);
+  return t->fs_edge;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Full sectors are read straight into BUFFER, IOV_CNT at a time;
+   only the partial sectors at either end pass through the
+   running thread's edge buffer. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  struct block_iovec iov[IOV_CNT];
+  size_t iov_cnt = 0;
 
+  rwlock_acquire_read (&inode->data_lock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,23 +588,34 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      sector_idx = block_to_sector (inode, offset / BLOCK_SECTOR_SIZE,
+                                    false, NULL);
+      if (sector_idx == 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Hole in a sparse file: reads as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
-      else 
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          /* Read full sector directly into caller's buffer, along
+             with the full sectors around it. */
+          iov[iov_cnt].sector = sector_idx;
+          iov[iov_cnt].buffer = buffer + bytes_read;
+          if (++iov_cnt == IOV_CNT)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              journal_readv (iov, iov_cnt);
+              iov_cnt = 0;
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+        }
+      else 
+        {
+          /* Read sector into the edge buffer, then partially copy
+             into caller's buffer. */
+          uint8_t *edge = edge_buffer ();
+          if (edge == NULL)
+            break;
+          journal_read (sector_idx, edge);
+          memcpy (buffer + bytes_read, edge + sector_ofs, chunk_size);
         }
       
       /* Advance. */
@@ -244,67 +623,114 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  journal_readv (iov, iov_cnt);
+  rwlock_release_read (&inode->data_lock);
 
   return bytes_read;
 }
 
+/* Returns true if the contents of INODE are metadata, which goes
+   through the journal: those of directories and of the free
+   map. */
+static bool
+is_metadata (const struct inode *inode)
+{
+  return inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Writes BUFFER to data SECTOR of INODE. */
+static void
+write_data (struct inode *inode, block_sector_t sector, const void *buffer)
+{
+  if (is_metadata (inode))
+    journal_write_metadata (sector, buffer);
+  else
+    journal_write_data (sector, buffer);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   Writing past end of file extends the inode.  Only the sectors
+   actually written are allocated, so any gap between the old end
+   of file and OFFSET stays a hole.  As in inode_read_at(), full
+   sectors of file data are written straight from BUFFER, IOV_CNT
+   at a time.  Sectors allocated for a batch are written before
+   the write ends, and the journal commits only between
+   operations, so no commit can make the pointers to them
+   durable while their new data is still pending. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  struct block_iovec iov[IOV_CNT];
+  size_t iov_cnt = 0;
 
+  /* The operation starts before the data lock is taken, because
+     starting it may wait for other operations to finish. */
+  journal_begin ();
+  rwlock_acquire_write (&inode->data_lock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->data_lock);
+      journal_end ();
+      return 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      bool fresh = false;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      sector_idx = block_to_sector (inode, offset / BLOCK_SECTOR_SIZE,
+                                    true, &fresh);
+      if (sector_idx == 0)
         break;
 
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Write full sector directly to disk, along with the
+             full sectors around it. */
+          if (is_metadata (inode))
+            journal_write_metadata (sector_idx, buffer + bytes_written);
+          else
+            {
+              iov[iov_cnt].sector = sector_idx;
+              iov[iov_cnt].buffer = (uint8_t *) buffer + bytes_written;
+              if (++iov_cnt == IOV_CNT)
+                {
+                  journal_writev_data (iov, iov_cnt);
+                  iov_cnt = 0;
+                }
+            }
         }
       else 
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
+          /* We need the edge buffer. */
+          uint8_t *edge = edge_buffer ();
+          if (edge == NULL)
+            break;
+
+          /* If the sector already holds data, read it in so we
+             keep the bytes before and after the chunk we're
+             writing.  A freshly allocated sector was part of a
+             hole, so it starts out as all zeros. */
+          if (!fresh) 
+            journal_read (sector_idx, edge);
           else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+            memset (edge, 0, BLOCK_SECTOR_SIZE);
+          memcpy (edge + sector_ofs, buffer + bytes_written, chunk_size);
+          write_data (inode, sector_idx, edge);
         }
 
       /* Advance. */
@@ -312,18 +738,30 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  journal_writev_data (iov, iov_cnt);
+
+  /* Extend the file only once its new data is on disk. */
+  if (offset > inode->data.length && bytes_written > 0)
+    {
+      inode->data.length = offset;
+      journal_write_metadata (inode->sector, &inode->data);
+    }
+  rwlock_release_write (&inode->data_lock);
+  journal_end ();
 
   return bytes_written;
 }
 
-/* Disables writes to INODE.
+/* Disables writes to INODE, waiting for any write in progress
+   to finish.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->data_lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->data_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +770,68 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->data_lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->data_lock);
+}
+
+/* Calls FUNC with AUX for each data and index sector of INODE,
+   visiting data sectors in order of file offset and each index
+   block before the sectors it points to.  Holes are skipped.
+   Returns false, without calling FUNC, if INODE's sector does
+   not hold a valid inode.  Used for checking the file system. */
+bool
+inode_walk (struct inode *inode, inode_walk_func *func, void *aux)
+{
+  struct inode_disk *d = &inode->data;
+  size_t i;
+
+  if (d->magic != INODE_MAGIC || d->length < 0)
+    return false;
+  rwlock_acquire_read (&inode->data_lock);
+  for (i = 0; i < DIRECT_CNT; i++)
+    walk_tree (d->direct[i], 0, func, aux);
+  walk_tree (d->indirect, 1, func, aux);
+  walk_tree (d->doubly_indirect, 2, func, aux);
+  rwlock_release_read (&inode->data_lock);
+  return true;
+}
+
+/* Returns true if INODE is a directory, false if it is an
+   ordinary file. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns true if INODE has been removed, so that it will be
+   deleted when its last opener closes it. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns the number of hash buckets in directory INODE, or 0
+   if the directory uses the linear format.  See directory.c. */
+unsigned
+inode_dir_buckets (const struct inode *inode)
+{
+  return inode->data.dir_buckets;
+}
+
+/* Sets the number of hash buckets in directory INODE to
+   BUCKET_CNT and writes the change to disk. */
+void
+inode_set_dir_buckets (struct inode *inode, unsigned bucket_cnt)
+{
+  rwlock_acquire_write (&inode->data_lock);
+  inode->data.dir_buckets = bucket_cnt;
+  journal_write_metadata (inode->sector, &inode->data);
+  rwlock_release_write (&inode->data_lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
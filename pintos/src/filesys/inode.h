@@ -8,16 +8,31 @@
 struct bitmap;
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_lock_shared (struct inode *);
+void inode_unlock_shared (struct inode *);
+void inode_lock (struct inode *);
+void inode_unlock (struct inode *);
+void inode_release_windows (void);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_is_dir (const struct inode *);
+bool inode_is_removed (const struct inode *);
+unsigned inode_dir_buckets (const struct inode *);
+void inode_set_dir_buckets (struct inode *, unsigned bucket_cnt);
+
+/* Called by inode_walk() for each sector of an inode, with
+   IS_DATA false for index blocks. */
+typedef void inode_walk_func (block_sector_t sector, bool is_data,
+                              void *aux);
+bool inode_walk (struct inode *, inode_walk_func *, void *aux);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,863 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* On-disk layout.
+
+   Sector JOURNAL_SECTOR holds a struct journal_header.  The log
+   proper is the log_cnt sectors that follow it.  Transactions are
+   appended to the log one after another, starting at its
+   beginning.  Each transaction is one or more descriptors, each
+   followed by the contents of the sectors that it lists, and
+   then a commit record.  A transaction counts only if its commit
+   record is intact and its checksum matches the logged sectors.
+
+   Once the sectors in the log have all been written to their
+   home locations, the log is emptied by writing a header whose
+   sequence number is that of the next transaction to be logged.
+   Records left over from before then have smaller sequence
+   numbers, so replay ignores them. */
+
+#define JOURNAL_MAGIC 0x4c4e524a        /* "JRNL". */
+#define DESC_MAGIC 0x4353454a           /* "JESC". */
+#define COMMIT_MAGIC 0x4d4d434a         /* "JCMM". */
+
+/* Number of sectors listed in one descriptor. */
+#define DESC_CNT 124
+
+/* Journal header. */
+struct journal_header
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Sequence number of first
+                                           transaction in the log. */
+    uint32_t unused[126];               /* Not used. */
+  };
+
+/* Transaction descriptor. */
+struct journal_desc
+  {
+    uint32_t magic;                     /* DESC_MAGIC. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Number of sectors listed. */
+    uint32_t unused;                    /* Not used. */
+    block_sector_t sectors[DESC_CNT];   /* Home locations of sectors. */
+  };
+
+/* Transaction commit record. */
+struct journal_commit
+  {
+    uint32_t magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Number of sectors logged. */
+    uint32_t checksum;                  /* Checksum of logged sectors. */
+    uint32_t unused[124];               /* Not used. */
+  };
+
+/* A sector held in memory by the journal, because it belongs to
+   the running transaction or because it has been committed but
+   not yet written to its home location. */
+struct jblock
+  {
+    struct hash_elem hash_elem;         /* Element in `blocks'. */
+    struct list_elem list_elem;         /* Element in `block_list'. */
+    block_sector_t sector;              /* Home location. */
+    bool dirty;                         /* Changed since last commit? */
+    uint8_t *data;                      /* Sector contents. */
+    struct block_request req;           /* Writes it home at checkpoint. */
+  };
+
+static struct hash blocks;              /* Held sectors, by sector. */
+static struct list block_list;          /* Held sectors, oldest first. */
+static size_t dirty_cnt;                /* Number of dirty sectors. */
+static struct lock journal_lock;        /* Protects the journal. */
+
+/* Held while committing a transaction and while syncing the free
+   map, so that the two never overlap.  Taken before
+   journal_lock. */
+static struct lock commit_lock;
+
+static block_sector_t log_start;        /* First sector of the log. */
+static block_sector_t log_cnt;          /* Number of sectors in the log. */
+static block_sector_t log_pos;          /* Next free sector in the log. */
+static uint32_t log_seq;                /* First transaction in the log. */
+static uint32_t next_seq;               /* Next transaction's number. */
+
+/* Transactions are committed only between operations, so that
+   each operation is atomic, unless it is too big for the log by
+   itself (see commit_dirty()).  A transaction is committed once
+   COMMIT_OPS operations have run, or once tx_max / 2 sectors are
+   dirty.  Once tx_max sectors are dirty, new operations wait for
+   the ones in progress to finish instead of adding still more,
+   so that the transaction stays small enough to fit in the
+   log. */
+static size_t tx_max;
+#define COMMIT_OPS 64
+
+/* Log space needed to commit a transaction of tx_max sectors,
+   plus every sector of the free map, which is brought up to date
+   just before committing, plus descriptors and the commit
+   record.  The log is emptied after a commit that leaves less
+   than this, so that the next transaction normally fits.  One
+   that does not is handled by commit_dirty(). */
+static size_t tx_reserve;
+
+/* Most sectors passed to one block_readv() or block_writev(),
+   and most sectors written to or read from the log in one
+   request. */
+#define BATCH_CNT 16
+
+/* Most home location writes that a checkpoint keeps in flight at
+   once, giving the device's scheduler that many to sort and merge
+   without crowding its queue. */
+#define CHECKPOINT_DEPTH 64
+
+/* Sectors being appended to the log are gathered here, so that
+   they can be written with a single request.  Also used for
+   reading the log back. */
+static uint8_t *log_buf;
+static size_t log_buf_cnt;              /* Sectors in log_buf. */
+
+static int active_cnt;                  /* Operations in progress. */
+static int op_cnt;                      /* Operations since last commit. */
+
+/* Set when the running transaction is to be committed as soon as
+   no operation is in progress.  New operations wait in
+   journal_begin() until it has been.  Both are protected by the
+   journal lock, and journal_idle is signaled when the last
+   operation in progress ends and when a commit finishes. */
+static bool commit_wanted;
+static bool committing;                 /* Commit in progress? */
+static struct condition journal_idle;
+
+/* Statistics. */
+static unsigned long long commit_cnt;       /* Transactions committed. */
+static unsigned long long logged_cnt;       /* Sectors logged. */
+static unsigned long long checkpoint_cnt;   /* Times the log was emptied. */
+static unsigned long long home_cnt;         /* Sectors written home. */
+
+static hash_hash_func jblock_hash;
+static hash_less_func jblock_less;
+static void replay (void);
+static uint32_t apply_log (uint32_t seq);
+static void write_header (void);
+static void checkpoint (void);
+
+/* Returns the number of log sectors taken by a transaction of CNT
+   sectors, including its descriptors and commit record. */
+static size_t
+tx_size (size_t cnt)
+{
+  return cnt + DIV_ROUND_UP (cnt, DESC_CNT) + 1;
+}
+
+/* Returns the number of sectors taken by the journal, including
+   its header, on a file system device with FS_SIZE sectors. */
+block_sector_t
+journal_sector_cnt (block_sector_t fs_size)
+{
+  block_sector_t cnt = fs_size / 32;
+  if (cnt < 64)
+    cnt = 64;
+  else if (cnt > 256)
+    cnt = 256;
+  return cnt + 1;
+}
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal on disk; otherwise, replays the transactions that were
+   committed to the log but not written home before the file
+   system was last shut down. */
+void
+journal_init (bool format)
+{
+  block_sector_t fs_size = block_size (fs_device);
+  size_t map_cnt = DIV_ROUND_UP (fs_size, BLOCK_SECTOR_SIZE * 8);
+
+  if (!hash_init (&blocks, jblock_hash, jblock_less, NULL))
+    PANIC ("can't allocate journal");
+  list_init (&block_list);
+  lock_init (&journal_lock);
+  lock_init (&commit_lock);
+  cond_init (&journal_idle);
+  log_buf = malloc (BATCH_CNT * BLOCK_SECTOR_SIZE);
+  if (log_buf == NULL)
+    PANIC ("can't allocate journal");
+
+  log_start = JOURNAL_SECTOR + 1;
+  log_cnt = journal_sector_cnt (fs_size) - 1;
+  if (log_start + log_cnt > fs_size)
+    PANIC ("file system device too small for journal");
+  tx_max = log_cnt / 4;
+  tx_reserve = tx_size (tx_max + map_cnt);
+  if (tx_reserve > log_cnt)
+    PANIC ("file system device too large for journal");
+
+  if (format)
+    {
+      next_seq = 1;
+      log_pos = 0;
+      write_header ();
+    }
+  else
+    replay ();
+}
+
+/* Commits any outstanding metadata and writes all of it home,
+   leaving the log empty. */
+void
+journal_done (void)
+{
+  journal_commit ();
+  lock_acquire (&commit_lock);
+  lock_acquire (&journal_lock);
+  if (log_pos > 0)
+    checkpoint ();
+  lock_release (&journal_lock);
+  lock_release (&commit_lock);
+}
+
+/* Keeps other threads from committing until
+   journal_unlock_commits() is called.  Returns true if
+   successful, false if the running thread is already committing
+   or has already locked commits, in which case
+   journal_unlock_commits() must not be called. */
+bool
+journal_lock_commits (void)
+{
+  if (lock_held_by_current_thread (&commit_lock))
+    return false;
+  lock_acquire (&commit_lock);
+  return true;
+}
+
+/* Allows commits again after journal_lock_commits(). */
+void
+journal_unlock_commits (void)
+{
+  lock_release (&commit_lock);
+}
+
+/* Returns the held block for SECTOR, or a null pointer if there
+   is none.  The journal lock must be held. */
+static struct jblock *
+find (block_sector_t sector)
+{
+  struct jblock key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&blocks, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct jblock, hash_elem) : NULL;
+}
+
+/* Folds the contents of sector DATA into CHECKSUM and returns
+   the result. */
+static uint32_t
+checksum_step (uint32_t checksum, const void *data)
+{
+  return checksum * 31 + hash_bytes (data, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes the journal header, which empties the log. */
+static void
+write_header (void)
+{
+  struct journal_header *h = calloc (1, sizeof *h);
+  if (h == NULL)
+    PANIC ("out of memory writing journal header");
+  h->magic = JOURNAL_MAGIC;
+  h->seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, h);
+  log_seq = next_seq;
+  free (h);
+}
+
+/* Writes each held sector to its home location, with several
+   writes in flight at once, releases them all, and empties the
+   log.  Every held sector must have been committed.  The journal
+   lock must be held. */
+static void
+checkpoint (void)
+{
+  struct list_elem *next = list_begin (&block_list);
+  size_t in_flight = 0;
+
+  ASSERT (dirty_cnt == 0);
+  while (!list_empty (&block_list))
+    {
+      struct list_elem *e;
+      struct jblock *b;
+
+      /* Submit writes ahead of the one we wait for. */
+      for (; next != list_end (&block_list) && in_flight < CHECKPOINT_DEPTH;
+           next = list_next (next))
+        {
+          b = list_entry (next, struct jblock, list_elem);
+          b->req.write = true;
+          b->req.sector = b->sector;
+          b->req.cnt = 1;
+          b->req.buffer = b->data;
+          b->req.complete = NULL;
+          block_submit (fs_device, &b->req);
+          in_flight++;
+        }
+
+      e = list_pop_front (&block_list);
+      b = list_entry (e, struct jblock, list_elem);
+      block_wait (&b->req);
+      in_flight--;
+      home_cnt++;
+      free (b->data);
+      free (b);
+    }
+  hash_clear (&blocks, NULL);
+
+  log_pos = 0;
+  write_header ();
+  checkpoint_cnt++;
+}
+
+/* Empties the log without writing any held sector home from
+   memory, which checkpoint() cannot do while some are dirty: a
+   dirty sector's committed contents are no longer in memory,
+   only in the log.  So the transactions in the log are written
+   home from the log itself, as replay does after a crash, after
+   which the clean held sectors are home and can be released.
+   The journal lock must be held. */
+static void
+flush_log (void)
+{
+  struct list_elem *e, *next;
+
+  ASSERT (log_buf_cnt == 0);
+  apply_log (log_seq);
+  for (e = list_begin (&block_list); e != list_end (&block_list); e = next)
+    {
+      struct jblock *b = list_entry (e, struct jblock, list_elem);
+      next = list_next (e);
+      if (!b->dirty)
+        {
+          list_remove (e);
+          hash_delete (&blocks, &b->hash_elem);
+          free (b->data);
+          free (b);
+        }
+    }
+
+  log_pos = 0;
+  write_header ();
+  checkpoint_cnt++;
+}
+
+/* Writes the sectors gathered in log_buf to the log, which end
+   just before log_pos. */
+static void
+log_flush (void)
+{
+  block_write_multiple (fs_device, log_start + log_pos - log_buf_cnt,
+                        log_buf_cnt, log_buf);
+  log_buf_cnt = 0;
+}
+
+/* Appends the sector in DATA to the log. */
+static void
+log_append (const void *data)
+{
+  ASSERT (log_pos < log_cnt);
+  memcpy (log_buf + log_buf_cnt * BLOCK_SECTOR_SIZE, data,
+          BLOCK_SECTOR_SIZE);
+  log_buf_cnt++;
+  log_pos++;
+  if (log_buf_cnt == BATCH_CNT)
+    log_flush ();
+}
+
+/* Appends the first CNT dirty sectors to the log as a
+   transaction, which must fit in the space left, and marks them
+   clean.  The journal lock must be held. */
+static void
+write_transaction (size_t cnt)
+{
+  struct journal_desc *d = malloc (sizeof *d);
+  struct journal_commit *c = calloc (1, sizeof *c);
+  struct list_elem *e = list_begin (&block_list);
+  uint32_t checksum = 0;
+  size_t left = cnt;
+
+  if (d == NULL || c == NULL)
+    PANIC ("out of memory committing journal transaction");
+  ASSERT (cnt > 0 && cnt <= dirty_cnt);
+  ASSERT (tx_size (cnt) <= log_cnt - log_pos);
+
+  while (left > 0)
+    {
+      struct jblock *batch[DESC_CNT];
+      size_t i;
+
+      /* Write a descriptor for the next batch of dirty sectors. */
+      memset (d, 0, sizeof *d);
+      d->magic = DESC_MAGIC;
+      d->seq = next_seq;
+      d->cnt = left < DESC_CNT ? left : DESC_CNT;
+      for (i = 0; i < d->cnt; e = list_next (e))
+        {
+          struct jblock *b = list_entry (e, struct jblock, list_elem);
+          if (b->dirty)
+            {
+              batch[i] = b;
+              d->sectors[i++] = b->sector;
+            }
+        }
+      log_append (d);
+
+      /* Then the sectors themselves. */
+      for (i = 0; i < d->cnt; i++)
+        {
+          log_append (batch[i]->data);
+          checksum = checksum_step (checksum, batch[i]->data);
+          batch[i]->dirty = false;
+        }
+      left -= d->cnt;
+    }
+
+  c->magic = COMMIT_MAGIC;
+  c->seq = next_seq++;
+  c->cnt = cnt;
+  c->checksum = checksum;
+  log_append (c);
+  log_flush ();
+
+  commit_cnt++;
+  logged_cnt += cnt;
+  dirty_cnt -= cnt;
+  free (c);
+  free (d);
+}
+
+/* Appends the dirty sectors to the log and marks them clean,
+   normally as a single transaction.  If it does not fit in the
+   space left in the log, empties the log first.  If it does not
+   fit even in an empty log, which takes a transaction much
+   bigger than tx_max, splits it into as many transactions as
+   needed, so that a crash may leave only some of them applied.
+   The journal lock must be held. */
+static void
+commit_dirty (void)
+{
+  while (dirty_cnt > 0)
+    {
+      size_t cnt = dirty_cnt;
+
+      if (tx_size (cnt) > log_cnt - log_pos && log_pos > 0)
+        flush_log ();
+      while (tx_size (cnt) > log_cnt - log_pos)
+        cnt--;
+      write_transaction (cnt);
+    }
+}
+
+/* Commits the running transaction: brings the free map up to
+   date, appends every sector changed since the last commit to
+   the log, and empties the log first if it might not have room
+   for the next transaction.  Keeps new operations from starting
+   and waits for those in progress, and for a commit in progress
+   in another thread, to finish first.  Does nothing if called
+   inside an operation, which cannot be split, or while the
+   running thread is committing, which may write the free map
+   file. */
+void
+journal_commit (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (active_cnt > 0 || committing)
+    {
+      commit_wanted = true;
+      cond_wait (&journal_idle, &journal_lock);
+    }
+  commit_wanted = true;
+  committing = true;
+  lock_release (&journal_lock);
+
+  /* Writing the free map file is an operation of its own, which
+     must neither wait for this commit nor start another. */
+  t->journal_depth++;
+  lock_acquire (&commit_lock);
+  free_map_sync ();
+  lock_acquire (&journal_lock);
+  commit_dirty ();
+  if (log_cnt - log_pos < tx_reserve)
+    checkpoint ();
+  op_cnt = 0;
+  lock_release (&journal_lock);
+  free_map_unhold ();
+  lock_release (&commit_lock);
+  t->journal_depth--;
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  commit_wanted = false;
+  cond_broadcast (&journal_idle, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Asks for the running transaction to be committed as soon as
+   the operations in progress have finished, without waiting for
+   it.  Used when an operation needs something that only a
+   commit can provide, such as the sectors held by the free
+   map. */
+void
+journal_want_commit (void)
+{
+  lock_acquire (&journal_lock);
+  commit_wanted = true;
+  lock_release (&journal_lock);
+}
+
+/* Marks the start of a file system operation.  All of the
+   changes made until the matching journal_end() go into the same
+   transaction.  Operations may nest, in which case only the
+   outermost one counts.  Waits, before starting an outermost
+   operation, for a commit that is wanted to happen, so the
+   caller must not hold any lock that an operation in progress
+   might need. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth > 0)
+    {
+      t->journal_depth++;
+      return;
+    }
+
+  lock_acquire (&journal_lock);
+  while (commit_wanted)
+    if (active_cnt == 0 && !committing)
+      {
+        /* The commit was wanted outside any operation, so no
+           journal_end() is left to make it. */
+        lock_release (&journal_lock);
+        journal_commit ();
+        lock_acquire (&journal_lock);
+      }
+    else
+      cond_wait (&journal_idle, &journal_lock);
+  active_cnt++;
+  t->journal_depth++;
+  lock_release (&journal_lock);
+}
+
+/* Marks the end of a file system operation begun with
+   journal_begin().  Commits the running transaction if it is
+   wanted or enough operations have been batched into it, once no
+   other operation is in progress. */
+void
+journal_end (void)
+{
+  bool commit;
+
+  ASSERT (thread_current ()->journal_depth > 0);
+  if (--thread_current ()->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (active_cnt > 0);
+  active_cnt--;
+  op_cnt++;
+  if (op_cnt >= COMMIT_OPS || dirty_cnt >= tx_max / 2)
+    commit_wanted = true;
+  commit = active_cnt == 0 && commit_wanted && !committing;
+  if (active_cnt == 0)
+    cond_broadcast (&journal_idle, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (commit)
+    journal_commit ();
+}
+
+/* Reads SECTOR of the file system device into BUFFER, taking it
+   from the journal if the journal holds it. */
+void
+journal_read (block_sector_t sector, void *buffer)
+{
+  struct jblock *b;
+
+  lock_acquire (&journal_lock);
+  b = find (sector);
+  if (b != NULL)
+    memcpy (buffer, b->data, BLOCK_SECTOR_SIZE);
+  lock_release (&journal_lock);
+
+  if (b == NULL)
+    block_read (fs_device, sector, buffer);
+}
+
+/* Reads the CNT sectors described by IOV from the file system
+   device, taking each one from the journal if the journal holds
+   it and reading the rest from the device in batches. */
+void
+journal_readv (const struct block_iovec *iov, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      struct block_iovec batch[BATCH_CNT];
+      size_t batch_cnt = 0;
+
+      lock_acquire (&journal_lock);
+      for (; cnt > 0 && batch_cnt < BATCH_CNT; iov++, cnt--)
+        {
+          struct jblock *b = find (iov->sector);
+          if (b != NULL)
+            memcpy (iov->buffer, b->data, BLOCK_SECTOR_SIZE);
+          else
+            batch[batch_cnt++] = *iov;
+        }
+      lock_release (&journal_lock);
+
+      block_readv (fs_device, batch, batch_cnt);
+    }
+}
+
+/* Records BUFFER as the new contents of SECTOR in the journal, if
+   the journal holds SECTOR or ALWAYS is true, and returns true.
+   Otherwise, returns false.  Once the running transaction is
+   big enough, keeps new operations from starting, so that it is
+   committed when those in progress finish. */
+static bool
+log_sector (block_sector_t sector, const void *buffer, bool always)
+{
+  struct jblock *b;
+
+  lock_acquire (&journal_lock);
+  b = find (sector);
+  if (b == NULL && always)
+    {
+      b = malloc (sizeof *b);
+      if (b != NULL)
+        {
+          b->data = malloc (BLOCK_SECTOR_SIZE);
+          if (b->data == NULL)
+            {
+              free (b);
+              b = NULL;
+            }
+        }
+      if (b != NULL)
+        {
+          b->sector = sector;
+          b->dirty = false;
+          hash_insert (&blocks, &b->hash_elem);
+          list_push_back (&block_list, &b->list_elem);
+        }
+    }
+  if (b == NULL)
+    {
+      lock_release (&journal_lock);
+      return false;
+    }
+
+  memcpy (b->data, buffer, BLOCK_SECTOR_SIZE);
+  if (!b->dirty)
+    {
+      b->dirty = true;
+      dirty_cnt++;
+    }
+  if (dirty_cnt >= tx_max)
+    commit_wanted = true;
+  lock_release (&journal_lock);
+  return true;
+}
+
+/* Writes BUFFER, which holds file system metadata, to SECTOR
+   through the journal.  If memory is too short to hold it, falls
+   back to writing it directly, at the cost of crash
+   consistency. */
+void
+journal_write_metadata (block_sector_t sector, const void *buffer)
+{
+  if (!log_sector (sector, buffer, true))
+    block_write (fs_device, sector, buffer);
+}
+
+/* Writes BUFFER, which holds ordinary file data, to SECTOR.
+   File data bypasses the journal, unless SECTOR held metadata
+   that has not been written home yet, in which case the new
+   data has to be logged too, so that a later checkpoint or
+   replay cannot overwrite it with the old metadata.
+
+   Must be called inside an operation.  The data then reaches
+   disk before the operation ends, and so before the commit that
+   makes the pointers to SECTOR durable, and a crash cannot
+   expose what SECTOR held before. */
+void
+journal_write_data (block_sector_t sector, const void *buffer)
+{
+  ASSERT (thread_current ()->journal_depth > 0);
+  if (!log_sector (sector, buffer, false))
+    block_write (fs_device, sector, buffer);
+}
+
+/* Writes the CNT sectors of ordinary file data described by IOV,
+   as if by journal_write_data(), writing those that bypass the
+   journal to the device in batches. */
+void
+journal_writev_data (const struct block_iovec *iov, size_t cnt)
+{
+  struct block_iovec batch[BATCH_CNT];
+  size_t batch_cnt = 0;
+
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  for (; cnt > 0; iov++, cnt--)
+    if (!log_sector (iov->sector, iov->buffer, false))
+      {
+        batch[batch_cnt++] = *iov;
+        if (batch_cnt == BATCH_CNT)
+          {
+            block_writev (fs_device, batch, batch_cnt);
+            batch_cnt = 0;
+          }
+      }
+  block_writev (fs_device, batch, batch_cnt);
+}
+
+/* Replays the log, writing the sectors of every intact
+   transaction in it to their home locations, and then empties
+   the log. */
+static void
+replay (void)
+{
+  struct journal_header *h = malloc (sizeof *h);
+  uint32_t first;
+
+  if (h == NULL)
+    PANIC ("out of memory replaying journal");
+
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != JOURNAL_MAGIC)
+    PANIC ("file system has no journal; reformat it with -f");
+  first = h->seq;
+  next_seq = apply_log (first);
+  if (next_seq != first)
+    printf ("journal: replayed %u transactions\n",
+            (unsigned) (next_seq - first));
+  log_pos = 0;
+  write_header ();
+  free (h);
+}
+
+/* Writes the sectors of every intact transaction in the log,
+   which must start with transaction number SEQ, to their home
+   locations, in order.  Returns the number of the transaction
+   after the last one written. */
+static uint32_t
+apply_log (uint32_t seq)
+{
+  struct journal_desc *d = malloc (sizeof *d);
+  block_sector_t fs_size = block_size (fs_device);
+  block_sector_t start = 0;
+
+  if (d == NULL)
+    PANIC ("out of memory reading journal");
+
+  for (;;)
+    {
+      /* Check that the whole transaction is there before applying
+         any of it, then apply it in a second pass. */
+      block_sector_t pos = start;
+      block_sector_t end = 0;
+      int pass;
+
+      for (pass = 0; pass < 2; pass++)
+        {
+          uint32_t checksum = 0;
+          uint32_t total = 0;
+
+          pos = start;
+          for (;;)
+            {
+              size_t i, j, n;
+
+              if (pos >= log_cnt)
+                goto done;
+              block_read (fs_device, log_start + pos++, d);
+              if (d->magic == COMMIT_MAGIC)
+                {
+                  struct journal_commit *c = (struct journal_commit *) d;
+                  if (c->seq != seq || c->cnt != total
+                      || c->checksum != checksum)
+                    goto done;
+                  end = pos;
+                  break;
+                }
+              if (d->magic != DESC_MAGIC || d->seq != seq
+                  || d->cnt > DESC_CNT || d->cnt > log_cnt - pos)
+                goto done;
+              for (i = 0; i < d->cnt; i += n)
+                {
+                  n = d->cnt - i < BATCH_CNT ? d->cnt - i : BATCH_CNT;
+                  block_read_multiple (fs_device, log_start + pos, n,
+                                       log_buf);
+                  pos += n;
+                  for (j = 0; j < n; j++)
+                    {
+                      uint8_t *data = log_buf + j * BLOCK_SECTOR_SIZE;
+                      if (d->sectors[i + j] >= fs_size)
+                        goto done;
+                      checksum = checksum_step (checksum, data);
+                      if (pass == 1)
+                        block_write (fs_device, d->sectors[i + j], data);
+                    }
+                }
+              total += d->cnt;
+            }
+        }
+      start = end;
+      seq++;
+    }
+
+ done:
+  free (d);
+  return seq;
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu transactions, %llu sectors logged, "
+          "%llu checkpoints, %llu sectors written home\n",
+          commit_cnt, logged_cnt, checkpoint_cnt, home_cnt);
+}
+
+/* Returns a hash value for jblock E. */
+static unsigned
+jblock_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct jblock, hash_elem)->sector);
+}
+
+/* Returns true if jblock A precedes jblock B. */
+static bool
+jblock_less (const struct hash_elem *a, const struct hash_elem *b,
+             void *aux UNUSED)
+{
+  return (hash_entry (a, struct jblock, hash_elem)->sector
+          < hash_entry (b, struct jblock, hash_elem)->sector);
+}
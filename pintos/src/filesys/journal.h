@@ -0,0 +1,38 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Write-ahead metadata journal.
+
+   Inode sectors, index blocks, directory data, and free map data
+   are written through the journal, which holds them in memory
+   and commits them to a log region on the file system device as
+   atomic transactions, batching many operations into each one.
+   Committed sectors are written to their home locations later,
+   when the log fills up or the file system shuts down, and the
+   log is replayed at startup after a crash.  All file system
+   sector reads go through the journal, so that they see sectors
+   that have not reached their home locations yet. */
+
+block_sector_t journal_sector_cnt (block_sector_t fs_size);
+void journal_init (bool format);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_commit (void);
+void journal_want_commit (void);
+bool journal_lock_commits (void);
+void journal_unlock_commits (void);
+
+void journal_read (block_sector_t, void *);
+void journal_readv (const struct block_iovec *, size_t cnt);
+void journal_write_metadata (block_sector_t, const void *);
+void journal_write_data (block_sector_t, const void *);
+void journal_writev_data (const struct block_iovec *, size_t cnt);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,221 @@
+#include "lz4.h"
+#include <stdbool.h>
+#include <string.h>
+#include "../debug.h"
+
+/* Each sequence in a compressed block is a token byte, whose high
+   nibble is a count of literal bytes and whose low nibble is the
+   length of a match minus MIN_MATCH, followed by any more of the
+   literal count, the literals themselves, a 2-byte little-endian
+   distance back to the start of the match, and any more of the
+   match length.  A nibble of 15 means that the count continues in
+   the following bytes, each added to it, up to and including the
+   first that is not 255.  The last sequence has only literals. */
+
+/* Shortest match that a sequence can encode. */
+#define MIN_MATCH 4
+
+/* The format requires the last LAST_LITERALS bytes of a block to
+   be literals, and the last match to start at least
+   MATCH_FIND_LIMIT bytes before the end. */
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+
+/* Returns the 4 bytes at P as a little-endian integer. */
+static inline uint32_t
+read32 (const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Returns the hash table index for the 4 bytes V. */
+static inline size_t
+hash4 (uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+/* Stores LEN, the part of a count that does not fit in a token's
+   nibble, at *OP as a run of 255s and a final byte less than 255,
+   and advances *OP past it.  Returns false if that would go past
+   END. */
+static bool
+put_count (uint8_t **op, uint8_t *end, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    {
+      if (*op >= end)
+        return false;
+      *(*op)++ = 255;
+    }
+  if (*op >= end)
+    return false;
+  *(*op)++ = len;
+  return true;
+}
+
+/* Stores at *OP a sequence of the LIT_CNT bytes at LITERALS
+   followed by a match of MATCH_LEN bytes starting OFFSET bytes
+   back, or no match if MATCH_LEN is 0, and advances *OP past it.
+   Returns false if that would go past END. */
+static bool
+put_sequence (uint8_t **op, uint8_t *end, const uint8_t *literals,
+              size_t lit_cnt, size_t offset, size_t match_len)
+{
+  uint8_t *token;
+
+  if (*op >= end)
+    return false;
+  token = (*op)++;
+  *token = (lit_cnt < 15 ? lit_cnt : 15) << 4;
+  if (lit_cnt >= 15 && !put_count (op, end, lit_cnt - 15))
+    return false;
+  if ((size_t) (end - *op) < lit_cnt)
+    return false;
+  memcpy (*op, literals, lit_cnt);
+  *op += lit_cnt;
+
+  if (match_len > 0)
+    {
+      size_t extra = match_len - MIN_MATCH;
+
+      if (end - *op < 2)
+        return false;
+      *(*op)++ = offset & 0xff;
+      *(*op)++ = offset >> 8;
+      *token |= extra < 15 ? extra : 15;
+      if (extra >= 15 && !put_count (op, end, extra - 15))
+        return false;
+    }
+  return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC, which must be less than
+   64 kB, into the DST_SIZE bytes at DST, using TABLE as scratch
+   space.  Returns the size of the compressed data, or 0 if it
+   does not fit in DST_SIZE bytes. */
+size_t
+lz4_compress (const void *src_, size_t src_size,
+              void *dst_, size_t dst_size,
+              uint16_t table[LZ4_TABLE_SIZE])
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *end = dst + dst_size;
+  size_t ip = 0;
+  size_t anchor = 0;
+
+  ASSERT (src_size <= UINT16_MAX);
+
+  if (src_size > MATCH_FIND_LIMIT)
+    {
+      memset (table, 0, LZ4_TABLE_SIZE * sizeof *table);
+      while (ip <= src_size - MATCH_FIND_LIMIT)
+        {
+          uint32_t v = read32 (src + ip);
+          size_t h = hash4 (v);
+          size_t candidate = table[h];
+
+          table[h] = ip;
+          if (candidate < ip && read32 (src + candidate) == v)
+            {
+              size_t limit = src_size - LAST_LITERALS;
+              size_t len = MIN_MATCH;
+
+              while (ip + len < limit
+                     && src[candidate + len] == src[ip + len])
+                len++;
+              if (!put_sequence (&op, end, src + anchor, ip - anchor,
+                                 ip - candidate, len))
+                return 0;
+              ip += len;
+              anchor = ip;
+            }
+          else
+            {
+              /* Skip ahead faster the longer it has been since the
+                 last match, so that incompressible data costs
+                 little time. */
+              ip += 1 + ((ip - anchor) >> 6);
+            }
+        }
+    }
+
+  if (!put_sequence (&op, end, src + anchor, src_size - anchor, 0, 0))
+    return 0;
+  return op - dst;
+}
+
+/* Reads a count continued from a token's nibble from *IP, which
+   must not pass END, adds it to *CNT, and advances *IP past it.
+   Returns false if the count runs past END. */
+static bool
+get_count (const uint8_t **ip, const uint8_t *end, size_t *cnt)
+{
+  uint8_t b;
+
+  do
+    {
+      if (*ip >= end)
+        return false;
+      b = *(*ip)++;
+      *cnt += b;
+    }
+  while (b == 255);
+  return true;
+}
+
+/* Decompresses the SRC_SIZE bytes of compressed data at SRC into
+   the DST_SIZE bytes at DST.  Returns the size of the
+   decompressed data, or 0 if SRC is malformed or the data does
+   not fit. */
+size_t
+lz4_decompress (const void *src_, size_t src_size,
+                void *dst_, size_t dst_size)
+{
+  const uint8_t *ip = src_;
+  const uint8_t *src_end = ip + src_size;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *dst_end = dst + dst_size;
+
+  while (ip < src_end)
+    {
+      uint8_t token = *ip++;
+      size_t lit_cnt = token >> 4;
+      size_t match_len = token & 15;
+      size_t offset;
+      const uint8_t *match;
+
+      if (lit_cnt == 15 && !get_count (&ip, src_end, &lit_cnt))
+        return 0;
+      if (lit_cnt > (size_t) (src_end - ip)
+          || lit_cnt > (size_t) (dst_end - op))
+        return 0;
+      memcpy (op, ip, lit_cnt);
+      ip += lit_cnt;
+      op += lit_cnt;
+      if (ip == src_end)
+        return op - dst;
+
+      if (src_end - ip < 2)
+        return 0;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (size_t) (op - dst))
+        return 0;
+      if (match_len == 15 && !get_count (&ip, src_end, &match_len))
+        return 0;
+      match_len += MIN_MATCH;
+      if (match_len > (size_t) (dst_end - op))
+        return 0;
+
+      /* The match may overlap the bytes it produces, so copy one
+         byte at a time. */
+      match = op - offset;
+      while (match_len-- > 0)
+        *op++ = *match++;
+    }
+  return 0;
+}
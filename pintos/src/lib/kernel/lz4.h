@@ -0,0 +1,28 @@
+#ifndef __LIB_KERNEL_LZ4_H
+#define __LIB_KERNEL_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compression in the LZ4 block format.
+
+   LZ4 trades compression ratio for speed: it finds repeated
+   strings through a small hash table and encodes them as
+   back-references, without any entropy coding, so that it can
+   keep up with a disk while using little CPU time.
+
+   The compressor's hash table is supplied by the caller, because
+   it is too big for a kernel thread's stack.  Inputs must be
+   smaller than 64 kB. */
+
+/* Number of entries in the compressor's hash table. */
+#define LZ4_HASH_BITS 11
+#define LZ4_TABLE_SIZE (1 << LZ4_HASH_BITS)
+
+size_t lz4_compress (const void *src, size_t src_size,
+                     void *dst, size_t dst_size,
+                     uint16_t table[LZ4_TABLE_SIZE]);
+size_t lz4_decompress (const void *src, size_t src_size,
+                       void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz4.h */
@@ -0,0 +1,49 @@
+#ifndef __LIB_SYSCALL_RING_H
+#define __LIB_SYSCALL_RING_H
+
+#include <stdint.h>
+
+/* A ring of system calls, shared between a user program and the
+   kernel, that lets the program make many system calls with a
+   single SYS_SUBMIT.
+
+   The program queues a call by filling in sq[sq_tail %
+   SYSCALL_RING_SIZE] and incrementing sq_tail.  SYS_SUBMIT then
+   makes each queued call in order, advancing sq_head past it and
+   storing its result in cq[cq_tail % SYSCALL_RING_SIZE] before
+   incrementing cq_tail.  It stops early if the completion queue
+   fills up, which the program prevents by consuming completions
+   and advancing cq_head.  The indexes only ever increase and wrap
+   around naturally. */
+
+/* Number of entries in each queue.  Must be a power of 2. */
+#define SYSCALL_RING_SIZE 64
+
+/* A queued system call. */
+struct syscall_entry
+  {
+    uint32_t number;            /* SYS_* system call number. */
+    int32_t args[3];            /* Arguments. */
+    uint32_t tag;               /* Copied into the completion. */
+  };
+
+/* The result of a system call made from the ring. */
+struct syscall_completion
+  {
+    uint32_t tag;               /* Tag from the entry. */
+    int32_t result;             /* Return value, or -1 if the call
+                                   number is invalid. */
+  };
+
+/* A submission queue and completion queue. */
+struct syscall_ring
+  {
+    uint32_t sq_head;           /* Next entry to call.  Kernel-owned. */
+    uint32_t sq_tail;           /* Next entry to fill.  User-owned. */
+    uint32_t cq_head;           /* Next completion.  User-owned. */
+    uint32_t cq_tail;           /* Next free completion.  Kernel-owned. */
+    struct syscall_entry sq[SYSCALL_RING_SIZE];
+    struct syscall_completion cq[SYSCALL_RING_SIZE];
+  };
+
+#endif /* lib/syscall-ring.h */
@@ -182,3 +182,52 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+/* Empties RING. */
+void
+ring_init (struct syscall_ring *ring) 
+{
+  ring->sq_head = ring->sq_tail = 0;
+  ring->cq_head = ring->cq_tail = 0;
+}
+
+/* Queues system call NUMBER with arguments ARG0, ARG1, and ARG2
+   in RING, to be made by the next submit(), and tags it with TAG.
+   Unused arguments are ignored.  Returns false if RING is full. */
+bool
+ring_queue (struct syscall_ring *ring, int number,
+            int arg0, int arg1, int arg2, unsigned tag) 
+{
+  struct syscall_entry *e;
+
+  if (ring->sq_tail - ring->sq_head >= SYSCALL_RING_SIZE)
+    return false;
+  e = &ring->sq[ring->sq_tail % SYSCALL_RING_SIZE];
+  e->number = number;
+  e->args[0] = arg0;
+  e->args[1] = arg1;
+  e->args[2] = arg2;
+  e->tag = tag;
+  ring->sq_tail++;
+  return true;
+}
+
+/* Removes the oldest completion from RING and stores it in *C.
+   Returns false if there is none. */
+bool
+ring_reap (struct syscall_ring *ring, struct syscall_completion *c) 
+{
+  if (ring->cq_head == ring->cq_tail)
+    return false;
+  *c = ring->cq[ring->cq_head % SYSCALL_RING_SIZE];
+  ring->cq_head++;
+  return true;
+}
+
+/* Makes the system calls queued in RING, in order, and returns
+   the number made. */
+int
+submit (struct syscall_ring *ring) 
+{
+  return syscall1 (SYS_SUBMIT, ring);
+}
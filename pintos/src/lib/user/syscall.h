@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <syscall-ring.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,11 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Batched system calls. */
+void ring_init (struct syscall_ring *);
+bool ring_queue (struct syscall_ring *, int number,
+                 int arg0, int arg1, int arg2, unsigned tag);
+bool ring_reap (struct syscall_ring *, struct syscall_completion *);
+int submit (struct syscall_ring *);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,50 @@
+/* Child process for syn-read-many test.
+   Reads its own test file a sector at a time, several times
+   over, while the other children do the same with theirs. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-read-many.h"
+
+const char *test_name = "child-syn-read-many";
+
+static char buf[BUF_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  char file_name[16];
+  int child_idx;
+  int pass;
+  int fd;
+
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (file_name, sizeof file_name, "data%d", child_idx);
+
+  random_init (child_idx);
+  random_bytes (buf, sizeof buf);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      size_t ofs;
+
+      seek (fd, 0);
+      for (ofs = 0; ofs < sizeof buf; ofs += 512) 
+        {
+          char block[512];
+          CHECK (read (fd, block, sizeof block) == sizeof block,
+                 "read \"%s\"", file_name);
+          compare_bytes (block, buf + ofs, sizeof block, ofs, file_name);
+        }
+    }
+  close (fd);
+
+  return child_idx;
+}
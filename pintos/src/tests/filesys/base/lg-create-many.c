@@ -0,0 +1,45 @@
+/* Creates several files whose combined initial size is far
+   larger than the file system device.  Creation should not
+   allocate or zero any data sectors up front, so all of the
+   creates succeed and every file still reads back as zeros.
+   lg-create-many.ck also checks the number of sectors written
+   to the file system device, which eager zero-filling would
+   blow up to thousands per file. */
+
+#include <syscall.h>
+#include <stdio.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 8
+#define FILE_SIZE (1024 * 1024)
+
+void
+test_main (void) 
+{
+  char file_name[16];
+  int i;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "big%d", i);
+      CHECK (create (file_name, FILE_SIZE), "create \"%s\"", file_name);
+    }
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char zero = 1;
+      int fd;
+
+      snprintf (file_name, sizeof file_name, "big%d", i);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      if (filesize (fd) != FILE_SIZE)
+        fail ("size of \"%s\" is %d, expected %d",
+              file_name, filesize (fd), FILE_SIZE);
+      seek (fd, FILE_SIZE - 1);
+      if (read (fd, &zero, 1) != 1 || zero != 0)
+        fail ("last byte of \"%s\" is not zero", file_name);
+      close (fd);
+    }
+  msg ("verified %d files", FILE_CNT);
+}
@@ -0,0 +1,35 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-create-many) begin
+(lg-create-many) create "big0"
+(lg-create-many) create "big1"
+(lg-create-many) create "big2"
+(lg-create-many) create "big3"
+(lg-create-many) create "big4"
+(lg-create-many) create "big5"
+(lg-create-many) create "big6"
+(lg-create-many) create "big7"
+(lg-create-many) open "big0"
+(lg-create-many) open "big1"
+(lg-create-many) open "big2"
+(lg-create-many) open "big3"
+(lg-create-many) open "big4"
+(lg-create-many) open "big5"
+(lg-create-many) open "big6"
+(lg-create-many) open "big7"
+(lg-create-many) verified 8 files
+(lg-create-many) end
+EOF
+
+# Extracting the test program costs a few hundred writes.  Zero
+# filling 8 MB of newly created files would cost 16,384 more.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($writes) = map (/\(filesys\): \d+ reads, (\d+) writes/, @output);
+fail "missing file system device statistics\n" if !defined $writes;
+fail "file system device saw $writes writes, expected at most 2000\n"
+  if $writes > 2000;
+pass;
@@ -0,0 +1,59 @@
+/* Creates a thousand files and keeps every one of them open
+   twice at the same time, so that the kernel's table of open
+   inodes holds a thousand entries while the second round of
+   opens looks each of them up again.  Then reads every file
+   through both of its descriptors to check that the duplicate
+   opens share the same data. */
+
+#include <syscall.h>
+#include <stdio.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 1000
+
+static int fds[2][FILE_CNT];
+
+void
+test_main (void) 
+{
+  char file_name[16];
+  int i, round;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "f%d", i);
+      if (!create (file_name, 0))
+        fail ("create \"%s\"", file_name);
+    }
+  msg ("created %d files", FILE_CNT);
+
+  for (round = 0; round < 2; round++)
+    {
+      for (i = 0; i < FILE_CNT; i++)
+        {
+          snprintf (file_name, sizeof file_name, "f%d", i);
+          fds[round][i] = open (file_name);
+          if (fds[round][i] < 2)
+            fail ("open \"%s\" (round %d)", file_name, round);
+        }
+      msg ("opened %d files (round %d)", FILE_CNT, round);
+    }
+
+  for (i = 0; i < FILE_CNT; i++)
+    if (write (fds[0][i], &i, sizeof i) != sizeof i)
+      fail ("write \"f%d\"", i);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      int value = -1;
+      if (read (fds[1][i], &value, sizeof value) != sizeof value
+          || value != i)
+        fail ("read back \"f%d\" through second descriptor", i);
+    }
+  msg ("verified %d files", FILE_CNT);
+
+  for (round = 0; round < 2; round++)
+    for (i = 0; i < FILE_CNT; i++)
+      close (fds[round][i]);
+  msg ("closed %d files", FILE_CNT);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-open-many) begin
+(lg-open-many) created 1000 files
+(lg-open-many) opened 1000 files (round 0)
+(lg-open-many) opened 1000 files (round 1)
+(lg-open-many) verified 1000 files
+(lg-open-many) closed 1000 files
+(lg-open-many) end
+EOF
+pass;
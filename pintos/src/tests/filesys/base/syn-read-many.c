@@ -0,0 +1,40 @@
+/* Creates a file for each of 8 child processes, then spawns the
+   children, each of which reads its own file over and over at
+   the same time as the others and makes sure that the contents
+   are what they should be.  Reads of different files should not
+   wait for each other. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/syn-read-many.h"
+
+static char buf[BUF_SIZE];
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  size_t i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      char file_name[16];
+      int fd;
+
+      snprintf (file_name, sizeof file_name, "data%zu", i);
+      random_init (i);
+      random_bytes (buf, sizeof buf);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+             "write \"%s\"", file_name);
+      msg ("close \"%s\"", file_name);
+      close (fd);
+    }
+
+  exec_children ("child-syn-read-many", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+}
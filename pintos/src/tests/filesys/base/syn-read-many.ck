@@ -0,0 +1,57 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF');
+(syn-read-many) begin
+(syn-read-many) create "data0"
+(syn-read-many) open "data0"
+(syn-read-many) write "data0"
+(syn-read-many) close "data0"
+(syn-read-many) create "data1"
+(syn-read-many) open "data1"
+(syn-read-many) write "data1"
+(syn-read-many) close "data1"
+(syn-read-many) create "data2"
+(syn-read-many) open "data2"
+(syn-read-many) write "data2"
+(syn-read-many) close "data2"
+(syn-read-many) create "data3"
+(syn-read-many) open "data3"
+(syn-read-many) write "data3"
+(syn-read-many) close "data3"
+(syn-read-many) create "data4"
+(syn-read-many) open "data4"
+(syn-read-many) write "data4"
+(syn-read-many) close "data4"
+(syn-read-many) create "data5"
+(syn-read-many) open "data5"
+(syn-read-many) write "data5"
+(syn-read-many) close "data5"
+(syn-read-many) create "data6"
+(syn-read-many) open "data6"
+(syn-read-many) write "data6"
+(syn-read-many) close "data6"
+(syn-read-many) create "data7"
+(syn-read-many) open "data7"
+(syn-read-many) write "data7"
+(syn-read-many) close "data7"
+(syn-read-many) exec child 1 of 8: "child-syn-read-many 0"
+(syn-read-many) exec child 2 of 8: "child-syn-read-many 1"
+(syn-read-many) exec child 3 of 8: "child-syn-read-many 2"
+(syn-read-many) exec child 4 of 8: "child-syn-read-many 3"
+(syn-read-many) exec child 5 of 8: "child-syn-read-many 4"
+(syn-read-many) exec child 6 of 8: "child-syn-read-many 5"
+(syn-read-many) exec child 7 of 8: "child-syn-read-many 6"
+(syn-read-many) exec child 8 of 8: "child-syn-read-many 7"
+(syn-read-many) wait for child 1 of 8 returned 0 (expected 0)
+(syn-read-many) wait for child 2 of 8 returned 1 (expected 1)
+(syn-read-many) wait for child 3 of 8 returned 2 (expected 2)
+(syn-read-many) wait for child 4 of 8 returned 3 (expected 3)
+(syn-read-many) wait for child 5 of 8 returned 4 (expected 4)
+(syn-read-many) wait for child 6 of 8 returned 5 (expected 5)
+(syn-read-many) wait for child 7 of 8 returned 6 (expected 6)
+(syn-read-many) wait for child 8 of 8 returned 7 (expected 7)
+(syn-read-many) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_BASE_SYN_READ_MANY_H
+#define TESTS_FILESYS_BASE_SYN_READ_MANY_H
+
+#define CHILD_CNT 8
+#define BUF_SIZE 8192
+#define PASS_CNT 4
+
+#endif /* tests/filesys/base/syn-read-many.h */
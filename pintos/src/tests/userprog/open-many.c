@@ -0,0 +1,37 @@
+/* Opens the same file many times, which must succeed with a
+   different file descriptor each time, then closes a few of them
+   and checks that the file descriptors are reused, lowest
+   first. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define OPEN_CNT 300
+
+void
+test_main (void) 
+{
+  static int handles[OPEN_CNT];
+  int i, j;
+
+  for (i = 0; i < OPEN_CNT; i++)
+    {
+      handles[i] = open ("sample.txt");
+      if (handles[i] < 2)
+        fail ("open() #%d returned %d", i, handles[i]);
+      for (j = 0; j < i; j++)
+        if (handles[i] == handles[j])
+          fail ("open() #%d and #%d both returned %d", j, i, handles[i]);
+    }
+  msg ("opened \"sample.txt\" %d times", OPEN_CNT);
+
+  close (handles[250]);
+  close (handles[10]);
+  close (handles[100]);
+  msg ("closed 3 handles");
+
+  CHECK (open ("sample.txt") == handles[10], "reopen gets lowest handle");
+  CHECK (open ("sample.txt") == handles[100], "reopen gets next handle");
+  CHECK (open ("sample.txt") == handles[250], "reopen gets last handle");
+}
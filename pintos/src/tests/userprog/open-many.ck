@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(open-many) begin
+(open-many) opened "sample.txt" 300 times
+(open-many) closed 3 handles
+(open-many) reopen gets lowest handle
+(open-many) reopen gets next handle
+(open-many) reopen gets last handle
+(open-many) end
+open-many: exit(0)
+EOF
+pass;
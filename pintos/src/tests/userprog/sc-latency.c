@@ -0,0 +1,117 @@
+/* Measures the average time taken by a few cheap system calls,
+   which is dominated by the cost of entering the kernel,
+   dispatching the call, and checking its arguments. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Number of calls to time for each system call. */
+#define ITERATIONS 10000
+
+/* Returns the processor's time-stamp counter. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* File descriptor of the open sample file. */
+static int handle;
+
+static void
+do_tell (void)
+{
+  tell (handle);
+}
+
+static void
+do_seek (void)
+{
+  seek (handle, 0);
+}
+
+static void
+do_read (void)
+{
+  char buf[16];
+
+  seek (handle, 0);
+  read (handle, buf, sizeof buf);
+}
+
+static void
+do_write_zero (void)
+{
+  write (STDOUT_FILENO, "", 0);
+}
+
+static void
+do_write_bad_fd (void)
+{
+  write (0x20101234, "x", 1);
+}
+
+/* Ring for batched calls. */
+static struct syscall_ring ring;
+
+static void
+do_tell_batched (void)
+{
+  struct syscall_completion c;
+  int i;
+
+  for (i = 0; i < SYSCALL_RING_SIZE; i++)
+    ring_queue (&ring, SYS_TELL, handle, 0, 0, i);
+  submit (&ring);
+  while (ring_reap (&ring, &c))
+    continue;
+}
+
+/* Calls FUNC, which makes CALL_CNT system calls, enough times to
+   make ITERATIONS calls, and reports the average number of cycles
+   that each system call took. */
+static void
+time_calls (const char *name, void (*func) (void), int call_cnt)
+{
+  uint64_t start;
+  int i;
+
+  start = read_tsc ();
+  for (i = 0; i < ITERATIONS / call_cnt; i++)
+    func ();
+  msg ("%s: %llu cycles per call", name,
+       (read_tsc () - start) / (ITERATIONS / call_cnt * call_cnt));
+}
+
+/* Calls FUNC ITERATIONS times and reports the average number of
+   cycles that each call took. */
+static void
+time_call (const char *name, void (*func) (void))
+{
+  time_calls (name, func, 1);
+}
+
+void
+test_main (void) 
+{
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  time_call ("tell", do_tell);
+  time_call ("seek", do_seek);
+  time_call ("seek and read 16 bytes", do_read);
+  time_call ("write 0 bytes to console", do_write_zero);
+  time_call ("write to bad fd", do_write_bad_fd);
+
+  ring_init (&ring);
+  time_calls ("tell, batched through submit", do_tell_batched,
+              SYSCALL_RING_SIZE);
+
+  msg ("close \"sample.txt\"");
+  close (handle);
+}
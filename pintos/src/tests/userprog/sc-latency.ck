@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# The timings vary from run to run, so only check that each call
+# was measured.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+s/: \d+ cycles per call$/: N cycles per call/ foreach @output;
+compare_output ("run", \@output, [<<'EOF']);
+(sc-latency) begin
+(sc-latency) open "sample.txt"
+(sc-latency) tell: N cycles per call
+(sc-latency) seek: N cycles per call
+(sc-latency) seek and read 16 bytes: N cycles per call
+(sc-latency) write 0 bytes to console: N cycles per call
+(sc-latency) write to bad fd: N cycles per call
+(sc-latency) tell, batched through submit: N cycles per call
+(sc-latency) close "sample.txt"
+(sc-latency) end
+sc-latency: exit(0)
+EOF
+pass;
@@ -0,0 +1,78 @@
+/* Queues several system calls in a ring, makes them with a single
+   submit(), and checks their results. */
+
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct syscall_ring ring;
+
+/* Reaps the next completion from the ring and checks that it has
+   the given TAG and RESULT. */
+static void
+expect (unsigned tag, int result) 
+{
+  struct syscall_completion c;
+
+  if (!ring_reap (&ring, &c))
+    fail ("no completion for call %u", tag);
+  if (c.tag != tag)
+    fail ("completion for call %u, expected %u", c.tag, tag);
+  if (c.result != result)
+    fail ("call %u returned %d, expected %d", tag, c.result, result);
+}
+
+void
+test_main (void) 
+{
+  static const char data[] = "0123456789abcdef";
+  char buf[sizeof data];
+  int handle, i;
+
+  CHECK (create ("ring.txt", 0), "create \"ring.txt\"");
+  CHECK ((handle = open ("ring.txt")) > 1, "open \"ring.txt\"");
+
+  ring_init (&ring);
+  ring_queue (&ring, SYS_WRITE, handle, (int) data, 8, 0);
+  ring_queue (&ring, SYS_WRITE, handle, (int) (data + 8), 8, 1);
+  ring_queue (&ring, SYS_TELL, handle, 0, 0, 2);
+  ring_queue (&ring, SYS_SEEK, handle, 4, 0, 3);
+  ring_queue (&ring, SYS_READ, handle, (int) buf, sizeof buf, 4);
+  ring_queue (&ring, SYS_FILESIZE, handle, 0, 0, 5);
+  ring_queue (&ring, SYS_SUBMIT, (int) &ring, 0, 0, 6);
+  ring_queue (&ring, 12345, 0, 0, 0, 7);
+  CHECK (submit (&ring) == 8, "submit 8 calls");
+
+  expect (0, 8);
+  expect (1, 8);
+  expect (2, 16);
+  expect (3, 0);
+  expect (4, 12);
+  expect (5, 16);
+  expect (6, -1);
+  expect (7, -1);
+  if (memcmp (buf, data + 4, 12))
+    fail ("read wrong data through ring");
+  msg ("checked completions");
+
+  /* Fill the completion queue without reaping it. */
+  ring_init (&ring);
+  for (i = 0; i < SYSCALL_RING_SIZE; i++)
+    if (!ring_queue (&ring, SYS_TELL, handle, 0, 0, i))
+      fail ("submission queue full after %d calls", i);
+  CHECK (!ring_queue (&ring, SYS_TELL, handle, 0, 0, i),
+         "submission queue full");
+  CHECK (submit (&ring) == SYSCALL_RING_SIZE, "submit full ring");
+  CHECK (ring_queue (&ring, SYS_TELL, handle, 0, 0, i),
+         "queue another call");
+  CHECK (submit (&ring) == 0, "submit with completion queue full");
+  for (i = 0; i < SYSCALL_RING_SIZE; i++)
+    expect (i, 16);
+  CHECK (submit (&ring) == 1, "submit after reaping");
+  expect (i, 16);
+
+  msg ("close \"ring.txt\"");
+  close (handle);
+}
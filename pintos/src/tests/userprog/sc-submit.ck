@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sc-submit) begin
+(sc-submit) create "ring.txt"
+(sc-submit) open "ring.txt"
+(sc-submit) submit 8 calls
+(sc-submit) checked completions
+(sc-submit) submission queue full
+(sc-submit) submit full ring
+(sc-submit) queue another call
+(sc-submit) submit with completion queue full
+(sc-submit) submit after reaping
+(sc-submit) close "ring.txt"
+(sc-submit) end
+sc-submit: exit(0)
+EOF
+pass;
@@ -34,6 +34,9 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/compress.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -52,6 +55,23 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -stripe, -concat: Comma-separated names of block devices to
+   combine into the "stripe" and "concat" block devices. */
+static char *stripe_bdev_names;
+static char *concat_bdev_names;
+
+/* -compress: Comma-separated names of block devices to put
+   compressed block devices on. */
+static char *compress_bdev_names;
+
+/* -ramdisk: Size of the RAM disk in kB, or 0 for none.
+   -ramdisk-load: Copy the scratch device into the RAM disk? */
+static size_t ramdisk_kb;
+static bool ramdisk_load_scratch;
+
+/* The RAM disk, if any. */
+static struct block *ramdisk;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -66,8 +86,13 @@ static void run_actions (char **argv);
 static void usage (void);
 
 #ifdef FILESYS
+static void create_block_devices (void);
+static void create_compressed_devices (char *names);
+static void create_block_device (const char *name, char *members,
+                                 block_sector_t chunk);
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
+static void load_ramdisk (void);
 #endif
 
 int main (void) NO_RETURN;
@@ -123,7 +148,9 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  create_block_devices ();
   locate_block_devices ();
+  load_ramdisk ();
   filesys_init (format_filesys);
 #endif
 
@@ -247,6 +274,22 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-stripe"))
+        stripe_bdev_names = value;
+      else if (!strcmp (name, "-concat"))
+        concat_bdev_names = value;
+      else if (!strcmp (name, "-compress"))
+        compress_bdev_names = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-ramdisk-load"))
+        ramdisk_load_scratch = true;
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (value == NULL || !block_set_default_scheduler (value))
+            PANIC ("unknown I/O scheduler `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -315,6 +358,9 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"fsck", 1, fsutil_fsck},
+      {"bench", 1, fsutil_bench},
+      {"iobench", 1, fsutil_iobench},
 #endif
       {NULL, 0, NULL},
     };
@@ -361,6 +407,9 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  fsck               Check file system and report fragmentation.\n"
+          "  bench              Time scratch device I/O (overwrites it).\n"
+          "  iobench            Compare I/O schedulers on scratch device.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -373,6 +422,13 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -stripe=BDEV,...   Stripe BDEVs as block device `stripe'.\n"
+          "  -concat=BDEV,...   Concatenate BDEVs as block device `concat'.\n"
+          "  -compress=BDEV,... Compress BDEVs as block devices `zBDEV'.\n"
+          "  -ramdisk=KB        Use a KB kB RAM disk `ram0' for file system.\n"
+          "  -ramdisk-load      Copy scratch device into RAM disk at boot.\n"
+          "  -iosched=POLICY    Schedule disk I/O with POLICY: noop, clook,\n"
+          "                     or deadline (the default).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -387,6 +443,78 @@ usage (void)
 }
 
 #ifdef FILESYS
+/* Creates the virtual block devices requested on the command
+   line. */
+static void
+create_block_devices (void)
+{
+  if (stripe_bdev_names != NULL)
+    create_block_device ("stripe", stripe_bdev_names, STRIPE_CHUNK);
+  if (concat_bdev_names != NULL)
+    create_block_device ("concat", concat_bdev_names, 0);
+  if (compress_bdev_names != NULL)
+    create_compressed_devices (compress_bdev_names);
+  if (ramdisk_kb > 0)
+    {
+      ramdisk = ramdisk_create ("ram0", BLOCK_FILESYS,
+                                ramdisk_kb * 1024 / BLOCK_SECTOR_SIZE);
+      if (filesys_bdev_name == NULL)
+        filesys_bdev_name = "ram0";
+    }
+}
+
+/* Creates block device NAME from the block devices named in
+   MEMBERS, separated by commas, striped in CHUNK-sector chunks or
+   concatenated if CHUNK is 0. */
+static void
+create_block_device (const char *name, char *members, block_sector_t chunk)
+{
+  struct block *blocks[8];
+  char *member, *save_ptr;
+  size_t cnt = 0;
+
+  for (member = strtok_r (members, ",", &save_ptr); member != NULL;
+       member = strtok_r (NULL, ",", &save_ptr))
+    {
+      if (cnt >= sizeof blocks / sizeof *blocks)
+        PANIC ("%s: too many block devices", name);
+      blocks[cnt] = block_get_by_name (member);
+      if (blocks[cnt] == NULL)
+        PANIC ("No such block device \"%s\"", member);
+      cnt++;
+    }
+  if (cnt == 0)
+    PANIC ("%s: no block devices given", name);
+  stripe_create (name, blocks, cnt, chunk);
+}
+
+/* Creates a compressed block device on each of the block devices
+   named in NAMES, separated by commas.  Each takes over its
+   backing device's role, unless another device was named for the
+   role. */
+static void
+create_compressed_devices (char *names)
+{
+  char *name, *save_ptr;
+
+  for (name = strtok_r (names, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *backing = block_get_by_name (name);
+      struct block *z;
+
+      if (backing == NULL)
+        PANIC ("No such block device \"%s\"", name);
+      z = compress_create (backing);
+      if (block_type (backing) == BLOCK_FILESYS && filesys_bdev_name == NULL)
+        filesys_bdev_name = block_name (z);
+#ifdef VM
+      if (block_type (backing) == BLOCK_SWAP && swap_bdev_name == NULL)
+        swap_bdev_name = block_name (z);
+#endif
+    }
+}
+
 /* Figure out what block devices to cast in the various Pintos roles. */
 static void
 locate_block_devices (void)
@@ -426,4 +554,19 @@ locate_block_device (enum block_type role, const char *name)
       block_set_role (role, block);
     }
 }
+
+/* Copies the scratch device into the RAM disk, if requested. */
+static void
+load_ramdisk (void)
+{
+  struct block *scratch = block_get_role (BLOCK_SCRATCH);
+
+  if (!ramdisk_load_scratch)
+    return;
+  if (ramdisk == NULL)
+    PANIC ("-ramdisk-load requires -ramdisk");
+  if (scratch == NULL)
+    PANIC ("-ramdisk-load requires a scratch device");
+  ramdisk_load (ramdisk, scratch);
+}
 #endif
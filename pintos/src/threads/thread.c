@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/block.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -14,6 +15,10 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#ifdef FILESYS
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
    Used to detect stack overflow.  See the big comment at the top
@@ -147,6 +152,16 @@ thread_print_stats (void)
           idle_ticks, kernel_ticks, user_ticks);
 }
 
+/* Returns the number of timer ticks spent idle since boot. */
+int64_t
+thread_idle_ticks (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  int64_t ticks = idle_ticks;
+  intr_set_level (old_level);
+  return ticks;
+}
+
 /* Creates a new kernel thread named NAME with the given initial
    PRIORITY, which executes FUNCTION passing AUX as the argument,
    and adds it to the ready queue.  Returns the thread identifier
@@ -184,6 +199,19 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
 
+#ifdef FILESYS
+  /* Inherit the creator's working directory. */
+  if (thread_current ()->cwd != NULL)
+    {
+      t->cwd = dir_reopen (thread_current ()->cwd);
+      if (t->cwd == NULL)
+        {
+          palloc_free_page (t);
+          return TID_ERROR;
+        }
+    }
+#endif
+
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack' 
      member cannot be observed. */
@@ -293,6 +321,13 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+#ifdef FILESYS
+  dir_close (thread_current ()->cwd);
+  thread_current ()->cwd = NULL;
+  free (thread_current ()->fs_edge);
+  thread_current ()->fs_edge = NULL;
+#endif
+  block_account_thread (thread_current ());
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -469,6 +504,9 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
   t->magic = THREAD_MAGIC;
+#ifdef USERPROG
+  list_init (&t->children);
+#endif
   list_push_back (&all_list, &t->allelem);
 }
 
@@ -96,8 +96,37 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct process *process;            /* Exit status shared with parent,
+                                           or null if not a process. */
+    struct list children;               /* Child processes. */
+    struct file *executable;            /* Program, kept open to deny
+                                           writes to it. */
+
+    /* Owned by userprog/syscall.c. */
+    struct file_descriptor **fds;       /* Open files, indexed by handle. */
+    uint32_t *fd_map;                   /* Bitmap of handles in use. */
+    int fd_cnt;                         /* Number of handles in fds. */
+    int fd_hint;                        /* No free handle in fd_map below
+                                           word fd_hint. */
 #endif
 
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Working directory, or null for root. */
+
+    /* Owned by filesys/inode.c. */
+    uint8_t *fs_edge;                   /* Buffer for partial sectors. */
+
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of file system
+                                           operations. */
+#endif
+
+    /* Owned by devices/block.c. */
+    unsigned long long io_read_cnt;     /* Sectors read. */
+    unsigned long long io_write_cnt;    /* Sectors written. */
+    unsigned long long io_request_cnt;  /* Block requests submitted. */
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -112,6 +141,7 @@ void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+int64_t thread_idle_ticks (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
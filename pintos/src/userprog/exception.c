@@ -2,8 +2,10 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,6 +150,20 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* A fault in the kernel at the user access in get_user() or
+     put_user() in userprog/syscall.c comes from checking a
+     pointer passed in a system call.  They put the address to
+     resume at in EAX; report the failure by returning -1 in
+     EAX.  Any other kernel fault is a kernel bug. */
+  if (!user && is_user_vaddr (fault_addr)
+      && (f->eip == (void (*) (void)) syscall_get_user_access
+          || f->eip == (void (*) (void)) syscall_put_user_access))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
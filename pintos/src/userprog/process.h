@@ -1,9 +1,24 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <list.h>
+#include "threads/synch.h"
 #include "threads/thread.h"
 
-tid_t process_execute (const char *file_name);
+/* A user process's exit status, shared between the process and
+   its parent.  Freed once both have released it. */
+struct process
+  {
+    struct list_elem elem;              /* Element in parent's children. */
+    tid_t tid;                          /* The process's thread. */
+    int exit_code;                      /* Exit status, -1 if killed. */
+    struct semaphore dead;              /* Upped when the process exits. */
+    struct lock lock;                   /* Protects ref_cnt. */
+    int ref_cnt;                        /* 2 = process and parent alive,
+                                           1 = either alive, 0 = free. */
+  };
+
+tid_t process_execute (const char *cmd_line);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -1,20 +1,748 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <syscall-ring.h>
+#include "userprog/process.h"
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* A system call implementation.  Every system call takes up to
+   three 32-bit arguments and returns a 32-bit value in EAX. */
+typedef int syscall_function (int, int, int);
+
+/* A system call. */
+struct syscall
+  {
+    size_t arg_cnt;             /* Number of arguments. */
+    syscall_function *func;     /* Implementation. */
+  };
+
+/* An open file descriptor. */
+struct file_descriptor
+  {
+    int handle;                 /* File handle. */
+    struct file *file;          /* File. */
+    struct dir *dir;            /* Directory, if FILE is one. */
+  };
+
+/* Each process's file descriptors are kept in an array indexed by
+   handle, so that looking one up takes constant time however many
+   are open.  A bitmap with one bit per handle, which is set for
+   handles in use, lets the lowest free handle be found a word at
+   a time.  Both start out null and grow by doubling.  Handles 0
+   and 1 are the console, so they are always marked in use. */
+
+/* Handles per word of the bitmap. */
+#define FD_MAP_BITS 32
+
+/* Initial number of handles. */
+#define FD_INITIAL_CNT FD_MAP_BITS
+
+static int sys_halt (void);
+static int sys_exit (int status);
+static int sys_exec (const char *ufile);
+static int sys_wait (tid_t);
+static int sys_create (const char *ufile, unsigned initial_size);
+static int sys_remove (const char *ufile);
+static int sys_open (const char *ufile);
+static int sys_filesize (int handle);
+static int sys_read (int handle, void *udst, unsigned size);
+static int sys_write (int handle, const void *usrc, unsigned size);
+static int sys_seek (int handle, unsigned position);
+static int sys_tell (int handle);
+static int sys_close (int handle);
+static int sys_mmap (int handle, void *addr);
+static int sys_munmap (int mapping);
+static int sys_chdir (const char *udir);
+static int sys_mkdir (const char *udir);
+static int sys_readdir (int handle, char *uname);
+static int sys_isdir (int handle);
+static int sys_inumber (int handle);
+static int sys_submit (struct syscall_ring *uring);
+
+/* Table of system calls, indexed by system call number.  The
+   implementations take their own argument types, so each is
+   cast to syscall_function by way of a generic function
+   pointer. */
+#define SYSCALL(NR, ARG_CNT, FUNC) \
+  [SYS_##NR] = {ARG_CNT, (syscall_function *) (void (*) (void)) FUNC}
+static const struct syscall syscall_table[] =
+  {
+    SYSCALL (HALT, 0, sys_halt),
+    SYSCALL (EXIT, 1, sys_exit),
+    SYSCALL (EXEC, 1, sys_exec),
+    SYSCALL (WAIT, 1, sys_wait),
+    SYSCALL (CREATE, 2, sys_create),
+    SYSCALL (REMOVE, 1, sys_remove),
+    SYSCALL (OPEN, 1, sys_open),
+    SYSCALL (FILESIZE, 1, sys_filesize),
+    SYSCALL (READ, 3, sys_read),
+    SYSCALL (WRITE, 3, sys_write),
+    SYSCALL (SEEK, 2, sys_seek),
+    SYSCALL (TELL, 1, sys_tell),
+    SYSCALL (CLOSE, 1, sys_close),
+    SYSCALL (MMAP, 2, sys_mmap),
+    SYSCALL (MUNMAP, 1, sys_munmap),
+    SYSCALL (CHDIR, 1, sys_chdir),
+    SYSCALL (MKDIR, 1, sys_mkdir),
+    SYSCALL (READDIR, 2, sys_readdir),
+    SYSCALL (ISDIR, 1, sys_isdir),
+    SYSCALL (INUMBER, 1, sys_inumber),
+    SYSCALL (SUBMIT, 1, sys_submit),
+  };
+
+#define SYSCALL_CNT (sizeof syscall_table / sizeof *syscall_table)
 
 static void syscall_handler (struct intr_frame *);
+static void copy_in (void *, const void *, size_t);
 
 void
-syscall_init (void) 
+syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* System call handler. */
+static void
+syscall_handler (struct intr_frame *f)
+{
+  const struct syscall *sc;
+  unsigned call_nr;
+  int args[3];
+
+  /* Get the system call. */
+  copy_in (&call_nr, f->esp, sizeof call_nr);
+  if (call_nr >= SYSCALL_CNT || syscall_table[call_nr].func == NULL)
+    thread_exit ();
+  sc = syscall_table + call_nr;
+
+  /* Get the system call arguments. */
+  ASSERT (sc->arg_cnt <= sizeof args / sizeof *args);
+  memset (args, 0, sizeof args);
+  copy_in (args, (uint32_t *) f->esp + 1, sizeof *args * sc->arg_cnt);
+
+  /* Execute the system call,
+     and set the return value. */
+  f->eax = sc->func (args[0], args[1], args[2]);
+}
+
+/* Reads a byte at user virtual address UADDR.
+   Returns the byte value if successful, -1 if UADDR is not a
+   user address or is not mapped.  A bad access, which faults at
+   syscall_get_user_access, makes page_fault() resume at the
+   label 1 with -1 in EAX.  Never inlined or cloned, so that the
+   label is defined exactly once. */
+static int __attribute__ ((noinline, noclone))
+get_user (const uint8_t *uaddr)
+{
+  int result;
+
+  if (!is_user_vaddr (uaddr))
+    return -1;
+  asm ("movl $1f, %0; .globl syscall_get_user_access;"
+       "syscall_get_user_access: movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST.
+   Returns true if successful, false if UDST is not a user
+   address or is not mapped writable.  A bad access faults at
+   syscall_put_user_access and is handled as in get_user(). */
+static bool __attribute__ ((noinline, noclone))
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+
+  if (!is_user_vaddr (udst))
+    return false;
+  asm ("movl $1f, %0; .globl syscall_put_user_access;"
+       "syscall_put_user_access: movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Terminates the process if any of the user accesses are
+   invalid. */
+static void
+copy_in (void *dst_, const void *usrc_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+
+  for (; size > 0; size--, dst++, usrc++)
+    {
+      int byte = get_user (usrc);
+      if (byte == -1)
+        thread_exit ();
+      *dst = byte;
+    }
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST.  Terminates the process if any of the user accesses are
+   invalid. */
+static void
+copy_out (void *udst_, const void *src_, size_t size)
+{
+  uint8_t *udst = udst_;
+  const uint8_t *src = src_;
+
+  for (; size > 0; size--, udst++, src++)
+    if (!put_user (udst, *src))
+      thread_exit ();
+}
+
+/* Creates a copy of user string US in kernel memory
+   and returns it as a page that must be freed with
+   palloc_free_page().
+   Truncates the string at PGSIZE bytes in size.
+   Terminates the process if any of the user accesses are
+   invalid. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks;
+  size_t length;
+
+  ks = palloc_get_page (0);
+  if (ks == NULL)
+    thread_exit ();
+
+  for (length = 0; length < PGSIZE; length++)
+    {
+      int c = get_user ((const uint8_t *) us + length);
+      if (c == -1)
+        {
+          palloc_free_page (ks);
+          thread_exit ();
+        }
+      ks[length] = c;
+      if (c == '\0')
+        return ks;
+    }
+  ks[PGSIZE - 1] = '\0';
+  return ks;
+}
+
+/* Checks that the SIZE bytes at user address UADDR, which must
+   all lie within one page, are mapped, and writable too if
+   WRITABLE is true.  Terminates the process if not.
+
+   Touching one byte is enough to check a whole page, after which
+   the kernel may access the buffer directly: there is no virtual
+   memory to take the page away again. */
+static void
+verify_user (const void *uaddr, size_t size, bool writable)
+{
+  uint8_t *p = (uint8_t *) uaddr;
+  int byte;
+
+  ASSERT (size > 0);
+  ASSERT (pg_no (p) == pg_no (p + size - 1));
+
+  byte = get_user (p);
+  if (byte == -1 || (writable && !put_user (p, byte)))
+    thread_exit ();
+}
+
+/* Returns the number of bytes of the SIZE bytes starting at user
+   address UADDR that lie within UADDR's page. */
+static size_t
+page_piece (const void *uaddr, size_t size)
+{
+  size_t page_left = PGSIZE - pg_ofs (uaddr);
+  return size < page_left ? size : page_left;
+}
+
+/* Checks that the SIZE bytes at user address UADDR are mapped,
+   and writable too if WRITABLE is true, one page at a time.
+   Terminates the process if not. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+verify_user_range (const void *uaddr, size_t size, bool writable)
+{
+  const uint8_t *p = uaddr;
+
+  while (size > 0)
+    {
+      size_t piece = page_piece (p, size);
+      verify_user (p, piece, writable);
+      p += piece;
+      size -= piece;
+    }
+}
+
+/* Halt system call. */
+static int
+sys_halt (void)
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call. */
+static int
+sys_exit (int exit_code)
 {
-  printf ("system call!\n");
+  thread_current ()->process->exit_code = exit_code;
   thread_exit ();
+  NOT_REACHED ();
+}
+
+/* Exec system call. */
+static int
+sys_exec (const char *ucmd_line)
+{
+  tid_t tid;
+  char *kcmd_line = copy_in_string (ucmd_line);
+
+  tid = process_execute (kcmd_line);
+
+  palloc_free_page (kcmd_line);
+
+  return tid;
+}
+
+/* Wait system call. */
+static int
+sys_wait (tid_t child)
+{
+  return process_wait (child);
+}
+
+/* Create system call. */
+static int
+sys_create (const char *ufile, unsigned initial_size)
+{
+  char *kfile = copy_in_string (ufile);
+  bool ok = filesys_create (kfile, initial_size);
+  palloc_free_page (kfile);
+
+  return ok;
+}
+
+/* Remove system call. */
+static int
+sys_remove (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  bool ok = filesys_remove (kfile);
+  palloc_free_page (kfile);
+
+  return ok;
+}
+
+/* Doubles the number of handles that T can have open.  Returns
+   true if successful, false if memory is exhausted. */
+static bool
+grow_fds (struct thread *t)
+{
+  int old_cnt = t->fd_cnt;
+  int new_cnt = old_cnt > 0 ? old_cnt * 2 : FD_INITIAL_CNT;
+  struct file_descriptor **fds;
+  uint32_t *fd_map;
+
+  fds = realloc (t->fds, new_cnt * sizeof *fds);
+  if (fds == NULL)
+    return false;
+  t->fds = fds;
+  memset (fds + old_cnt, 0, (new_cnt - old_cnt) * sizeof *fds);
+
+  fd_map = realloc (t->fd_map, new_cnt / FD_MAP_BITS * sizeof *fd_map);
+  if (fd_map == NULL)
+    return false;
+  t->fd_map = fd_map;
+  memset (fd_map + old_cnt / FD_MAP_BITS, 0,
+          (new_cnt - old_cnt) / FD_MAP_BITS * sizeof *fd_map);
+
+  /* Reserve the console's handles. */
+  if (old_cnt == 0)
+    fd_map[0] = (1u << STDIN_FILENO) | (1u << STDOUT_FILENO);
+
+  t->fd_cnt = new_cnt;
+  return true;
+}
+
+/* Gives FD the lowest handle not in use in T, and returns the
+   handle, or -1 if memory is exhausted. */
+static int
+install_fd (struct thread *t, struct file_descriptor *fd)
+{
+  int word_cnt;
+
+  for (;;)
+    {
+      word_cnt = t->fd_cnt / FD_MAP_BITS;
+      for (; t->fd_hint < word_cnt; t->fd_hint++)
+        {
+          uint32_t *word = &t->fd_map[t->fd_hint];
+          if (*word != UINT32_MAX)
+            {
+              int bit = __builtin_ctz (~*word);
+              *word |= 1u << bit;
+              fd->handle = t->fd_hint * FD_MAP_BITS + bit;
+              t->fds[fd->handle] = fd;
+              return fd->handle;
+            }
+        }
+      if (!grow_fds (t))
+        return -1;
+    }
+}
+
+/* Frees HANDLE in T for reuse. */
+static void
+remove_fd (struct thread *t, int handle)
+{
+  int word = handle / FD_MAP_BITS;
+
+  t->fds[handle] = NULL;
+  t->fd_map[word] &= ~(1u << handle % FD_MAP_BITS);
+  if (word < t->fd_hint)
+    t->fd_hint = word;
+}
+
+/* Open system call. */
+static int
+sys_open (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  struct thread *cur = thread_current ();
+  struct file_descriptor *fd;
+  int handle = -1;
+
+  fd = malloc (sizeof *fd);
+  if (fd != NULL)
+    {
+      fd->dir = NULL;
+      fd->file = filesys_open (kfile);
+      if (fd->file != NULL
+          && inode_is_dir (file_get_inode (fd->file)))
+        {
+          fd->dir = dir_open (inode_reopen (file_get_inode (fd->file)));
+          if (fd->dir == NULL)
+            {
+              file_close (fd->file);
+              fd->file = NULL;
+            }
+        }
+      if (fd->file != NULL)
+        handle = install_fd (cur, fd);
+      if (handle == -1)
+        {
+          file_close (fd->file);
+          dir_close (fd->dir);
+          free (fd);
+        }
+    }
+
+  palloc_free_page (kfile);
+  return handle;
+}
+
+/* Returns the file descriptor associated with the given handle,
+   or a null pointer if HANDLE is not open in the current
+   process. */
+static struct file_descriptor *
+lookup_fd (int handle)
+{
+  struct thread *cur = thread_current ();
+
+  if (handle < 0 || handle >= cur->fd_cnt)
+    return NULL;
+  return cur->fds[handle];
+}
+
+/* Returns the file descriptor associated with HANDLE if it is an
+   open ordinary file, or a null pointer otherwise. */
+static struct file_descriptor *
+lookup_file_fd (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  return fd != NULL && fd->dir == NULL ? fd : NULL;
+}
+
+/* Returns the file descriptor associated with HANDLE if it is an
+   open directory, or a null pointer otherwise. */
+static struct file_descriptor *
+lookup_dir_fd (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  return fd != NULL && fd->dir != NULL ? fd : NULL;
+}
+
+/* Filesize system call. */
+static int
+sys_filesize (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  return fd != NULL ? file_length (fd->file) : -1;
+}
+
+/* Read system call. */
+static int
+sys_read (int handle, void *udst_, unsigned size)
+{
+  uint8_t *udst = udst_;
+  struct file_descriptor *fd;
+  int bytes_read = 0;
+
+  /* Handle keyboard reads. */
+  if (handle == STDIN_FILENO)
+    {
+      for (bytes_read = 0; (size_t) bytes_read < size; bytes_read++)
+        if (!put_user (udst++, input_getc ()))
+          thread_exit ();
+      return bytes_read;
+    }
+
+  fd = lookup_file_fd (handle);
+  if (fd == NULL)
+    return -1;
+
+  /* Handle file reads a page at a time. */
+  while (size > 0)
+    {
+      size_t read_amt = page_piece (udst, size);
+      off_t retval;
+
+      verify_user (udst, read_amt, true);
+      retval = file_read (fd->file, udst, read_amt);
+      if (retval < 0)
+        {
+          if (bytes_read == 0)
+            bytes_read = -1;
+          break;
+        }
+      bytes_read += retval;
+
+      /* If it was a short read we're done. */
+      if (retval != (off_t) read_amt)
+        break;
+
+      /* Advance. */
+      udst += retval;
+      size -= retval;
+    }
+
+  return bytes_read;
+}
+
+/* Write system call. */
+static int
+sys_write (int handle, const void *usrc_, unsigned size)
+{
+  const uint8_t *usrc = usrc_;
+  struct file_descriptor *fd = NULL;
+  int bytes_written = 0;
+
+  /* Lookup up file descriptor. */
+  if (handle != STDOUT_FILENO)
+    {
+      fd = lookup_file_fd (handle);
+      if (fd == NULL)
+        return -1;
+    }
+
+  while (size > 0)
+    {
+      /* How many bytes to write to this page? */
+      size_t write_amt = page_piece (usrc, size);
+      off_t retval;
+
+      /* Do the write. */
+      verify_user (usrc, write_amt, false);
+      if (handle == STDOUT_FILENO)
+        {
+          putbuf ((const char *) usrc, write_amt);
+          retval = write_amt;
+        }
+      else
+        retval = file_write (fd->file, usrc, write_amt);
+      if (retval < 0)
+        {
+          if (bytes_written == 0)
+            bytes_written = -1;
+          break;
+        }
+      bytes_written += retval;
+
+      /* If it was a short write we're done. */
+      if (retval != (off_t) write_amt)
+        break;
+
+      /* Advance. */
+      usrc += retval;
+      size -= retval;
+    }
+
+  return bytes_written;
+}
+
+/* Seek system call. */
+static int
+sys_seek (int handle, unsigned position)
+{
+  struct file_descriptor *fd = lookup_file_fd (handle);
+  if (fd != NULL && (off_t) position >= 0)
+    file_seek (fd->file, position);
+  return 0;
+}
+
+/* Tell system call. */
+static int
+sys_tell (int handle)
+{
+  struct file_descriptor *fd = lookup_file_fd (handle);
+  return fd != NULL ? file_tell (fd->file) : -1;
+}
+
+/* Closes FD and frees it. */
+static void
+close_fd (struct file_descriptor *fd)
+{
+  remove_fd (thread_current (), fd->handle);
+  file_close (fd->file);
+  dir_close (fd->dir);
+  free (fd);
+}
+
+/* Close system call. */
+static int
+sys_close (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  if (fd != NULL)
+    close_fd (fd);
+  return 0;
+}
+
+/* Mmap system call.  There is no virtual memory to map files
+   into, so this always fails. */
+static int
+sys_mmap (int handle UNUSED, void *addr UNUSED)
+{
+  return -1;
+}
+
+/* Munmap system call.  No mapping can exist, so there is
+   nothing to do. */
+static int
+sys_munmap (int mapping UNUSED)
+{
+  return 0;
+}
+
+/* Chdir system call. */
+static int
+sys_chdir (const char *udir)
+{
+  char *kdir = copy_in_string (udir);
+  bool ok = filesys_chdir (kdir);
+  palloc_free_page (kdir);
+
+  return ok;
+}
+
+/* Mkdir system call. */
+static int
+sys_mkdir (const char *udir)
+{
+  char *kdir = copy_in_string (udir);
+  bool ok = filesys_mkdir (kdir);
+  palloc_free_page (kdir);
+
+  return ok;
+}
+
+/* Readdir system call. */
+static int
+sys_readdir (int handle, char *uname)
+{
+  struct file_descriptor *fd = lookup_dir_fd (handle);
+  char name[NAME_MAX + 1];
+
+  if (fd == NULL || !dir_readdir (fd->dir, name))
+    return false;
+  copy_out (uname, name, strlen (name) + 1);
+  return true;
+}
+
+/* Isdir system call. */
+static int
+sys_isdir (int handle)
+{
+  return lookup_dir_fd (handle) != NULL;
+}
+
+/* Inumber system call. */
+static int
+sys_inumber (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  return fd != NULL ? (int) inode_get_inumber (file_get_inode (fd->file))
+                    : -1;
+}
+
+/* Submit system call.  Makes the calls queued in URING, without
+   entering and leaving the kernel for each one, until the
+   submission queue empties or the completion queue fills up. */
+static int
+sys_submit (struct syscall_ring *uring)
+{
+  int call_cnt = 0;
+
+  /* Check the ring once, so that it can be accessed directly
+     afterward. */
+  verify_user_range (uring, sizeof *uring, true);
+
+  while (uring->sq_head != uring->sq_tail
+         && uring->cq_tail - uring->cq_head < SYSCALL_RING_SIZE)
+    {
+      struct syscall_entry e = uring->sq[uring->sq_head
+                                         % SYSCALL_RING_SIZE];
+      struct syscall_completion *c;
+      int result = -1;
+
+      uring->sq_head++;
+      if (e.number < SYSCALL_CNT && e.number != SYS_SUBMIT
+          && syscall_table[e.number].func != NULL)
+        result = syscall_table[e.number].func (e.args[0], e.args[1],
+                                               e.args[2]);
+
+      c = &uring->cq[uring->cq_tail % SYSCALL_RING_SIZE];
+      c->tag = e.tag;
+      c->result = result;
+      uring->cq_tail++;
+      call_cnt++;
+    }
+  return call_cnt;
+}
+
+/* On thread exit, close all open files. */
+void
+syscall_exit (void)
+{
+  struct thread *cur = thread_current ();
+  int handle;
+
+  for (handle = 0; handle < cur->fd_cnt; handle++)
+    if (cur->fds[handle] != NULL)
+      close_fd (cur->fds[handle]);
+  free (cur->fds);
+  free (cur->fd_map);
+  cur->fds = NULL;
+  cur->fd_map = NULL;
+  cur->fd_cnt = 0;
+  cur->fd_hint = 0;
 }
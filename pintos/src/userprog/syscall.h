@@ -2,5 +2,11 @@
 #define USERPROG_SYSCALL_H
 
 void syscall_init (void);
+void syscall_exit (void);
+
+/* The instructions in which system calls access user memory.
+   page_fault() recovers from a kernel fault only at these. */
+extern const char syscall_get_user_access[];
+extern const char syscall_put_user_access[];
 
 #endif /* userprog/syscall.h */